@@ -0,0 +1,163 @@
+#include "BatchHash.h"
+
+#include <algorithm>
+#include <string.h>
+
+#include <crypto++/config.h>
+#include <crypto++/sha.h>
+#if defined(CRYPTOPP_SHANI_AVAILABLE)
+#include <crypto++/cpu.h>
+#endif
+
+typedef uint32_t ShaVec __attribute__((vector_size(4*SHA256_LANES)));
+
+static const uint32_t sha256_k[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static const uint32_t sha256_init[8] = {
+  0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+#define ROTR(x,n) (((x)>>(n))|((x)<<(32-(n))))
+
+/* One 64 byte block for each of the SHA256_LANES lanes */
+#if defined(__x86_64__) && defined(__GNUC__)
+__attribute__((target_clones("avx2","default")))
+#endif
+static void sha256_compress_lanes(ShaVec state[8], const unsigned char* const blocks[SHA256_LANES]) {
+  ShaVec w[64];
+  for(int t=0; t<16; t++) {
+    for(int l=0; l<SHA256_LANES; l++) {
+      const unsigned char* p=blocks[l]+4*t;
+      w[t][l]=((uint32_t)p[0]<<24)|((uint32_t)p[1]<<16)|((uint32_t)p[2]<<8)|p[3];
+    }
+  }
+  for(int t=16; t<64; t++) {
+    ShaVec s0=ROTR(w[t-15],7)^ROTR(w[t-15],18)^(w[t-15]>>3);
+    ShaVec s1=ROTR(w[t-2],17)^ROTR(w[t-2],19)^(w[t-2]>>10);
+    w[t]=w[t-16]+s0+w[t-7]+s1;
+  }
+
+  ShaVec a=state[0], b=state[1], c=state[2], d=state[3];
+  ShaVec e=state[4], f=state[5], g=state[6], h=state[7];
+  for(int t=0; t<64; t++) {
+    ShaVec S1=ROTR(e,6)^ROTR(e,11)^ROTR(e,25);
+    ShaVec ch=(e&f)^(~e&g);
+    ShaVec t1=h+S1+ch+sha256_k[t]+w[t];
+    ShaVec S0=ROTR(a,2)^ROTR(a,13)^ROTR(a,22);
+    ShaVec maj=(a&b)^(a&c)^(b&c);
+    ShaVec t2=S0+maj;
+    h=g; g=f; f=e; e=d+t1;
+    d=c; c=b; b=a; a=t1+t2;
+  }
+  state[0]+=a; state[1]+=b; state[2]+=c; state[3]+=d;
+  state[4]+=e; state[5]+=f; state[6]+=g; state[7]+=h;
+}
+
+static void sha256_multibuffer(const unsigned char* const* msgs, size_t len, size_t count, unsigned char* digests) {
+  size_t nblocks=(len+9+63)/64;
+  std::vector<unsigned char> padded(SHA256_LANES*nblocks*64);
+
+  for(size_t base=0; base<count; base+=SHA256_LANES) {
+    size_t lanes=std::min((size_t)SHA256_LANES, count-base);
+
+    std::fill(padded.begin(), padded.end(), 0);
+    for(size_t l=0; l<lanes; l++) {
+      unsigned char* p=&padded[l*nblocks*64];
+      memcpy(p, msgs[base+l], len);
+      p[len]=0x80;
+      uint64_t bits=(uint64_t)len*8;
+      for(int i=0; i<8; i++) {
+	p[nblocks*64-1-i]=bits>>(8*i);
+      }
+    }
+
+    ShaVec state[8];
+    for(int i=0; i<8; i++) {
+      for(int l=0; l<SHA256_LANES; l++) {
+	state[i][l]=sha256_init[i];
+      }
+    }
+    for(size_t blk=0; blk<nblocks; blk++) {
+      const unsigned char* blocks[SHA256_LANES];
+      for(size_t l=0; l<SHA256_LANES; l++) {
+	//Unused lanes just repeat the first message
+	blocks[l]=&padded[(l<lanes ? l : 0)*nblocks*64+blk*64];
+      }
+      sha256_compress_lanes(state, blocks);
+    }
+
+    for(size_t l=0; l<lanes; l++) {
+      unsigned char* out=digests+(base+l)*SHA256_DIGEST_SIZE;
+      for(int i=0; i<8; i++) {
+	uint32_t v=state[i][l];
+	out[4*i]=v>>24;
+	out[4*i+1]=v>>16;
+	out[4*i+2]=v>>8;
+	out[4*i+3]=v;
+      }
+    }
+  }
+}
+
+static bool have_shani() {
+#if defined(CRYPTOPP_SHANI_AVAILABLE)
+  static const bool shani=CryptoPP::HasSHA();
+  return shani;
+#else
+  return false;
+#endif
+}
+
+void sha256_batch(const unsigned char* const* msgs, size_t len, size_t count, unsigned char* digests) {
+  if(have_shani()) {
+    CryptoPP::SHA256 sha;
+    for(size_t i=0; i<count; i++) {
+      sha.CalculateDigest(digests+i*SHA256_DIGEST_SIZE, msgs[i], len);
+    }
+    return;
+  }
+  sha256_multibuffer(msgs, len, count, digests);
+}
+
+void BatchHasher::add(const unsigned char* msg, size_t len, unsigned char* digest) {
+  Job j;
+  j.len=len;
+  j.msg=msg;
+  j.digest=digest;
+  jobs.push_back(j);
+}
+
+void BatchHasher::flush() {
+  std::stable_sort(jobs.begin(), jobs.end());
+
+  std::vector<const unsigned char*> msgs;
+  std::vector<unsigned char> digests;
+  for(size_t begin=0; begin<jobs.size();) {
+    size_t end=begin;
+    while(end<jobs.size() && jobs[end].len==jobs[begin].len) {
+      end++;
+    }
+
+    msgs.clear();
+    for(size_t i=begin; i<end; i++) {
+      msgs.push_back(jobs[i].msg);
+    }
+    digests.resize((end-begin)*SHA256_DIGEST_SIZE);
+    sha256_batch(msgs.data(), jobs[begin].len, end-begin, digests.data());
+    for(size_t i=begin; i<end; i++) {
+      memcpy(jobs[i].digest, &digests[(i-begin)*SHA256_DIGEST_SIZE], SHA256_DIGEST_SIZE);
+    }
+
+    begin=end;
+  }
+  jobs.clear();
+}
@@ -0,0 +1,35 @@
+#ifndef BATCH_HASH_H
+#define BATCH_HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#define SHA256_DIGEST_SIZE 32
+#define SHA256_LANES 8
+
+/* Hashes count messages of the same length.  Uses SHA-NI through Crypto++
+   when the CPU has it, otherwise the messages go SHA256_LANES at a time
+   through a multi-buffer implementation (AVX2 when available).  digests
+   receives SHA256_DIGEST_SIZE bytes per message, in order. */
+void sha256_batch(const unsigned char* const* msgs, size_t len, size_t count, unsigned char* digests);
+
+/* Collects messages of any length and hashes them in batches of equal
+   length on flush().  Messages must stay valid until then. */
+class BatchHasher {
+ public:
+  void add(const unsigned char* msg, size_t len, unsigned char* digest);
+  void flush();
+
+ private:
+  struct Job {
+    size_t len;
+    const unsigned char* msg;
+    unsigned char* digest;
+
+    bool operator<(const Job& o) const { return len<o.len; }
+  };
+  std::vector<Job> jobs;
+};
+
+#endif //BATCH_HASH_H
@@ -0,0 +1,47 @@
+#include "Bits.h"
+
+#include <algorithm>
+
+void pack_bits(const std::vector<bool>& bits, std::string* out) {
+  out->assign((bits.size()+7)/8, 0);
+  for(size_t i=0; i<bits.size(); i++) {
+    if(bits[i]) {
+      (*out)[i>>3]|=1<<(i&7);
+    }
+  }
+}
+
+void unpack_bits(const BitView& view, std::vector<bool>& bits) {
+  bits.resize(view.size());
+  for(int i=0; i<view.size(); i++) {
+    bits[i]=view[i];
+  }
+}
+
+void pack_words(const std::vector<bool>& bits, std::vector<uint64_t>& words) {
+  words.assign((bits.size()+63)/64, 0);
+  for(size_t i=0; i<bits.size(); i++) {
+    if(bits[i]) {
+      words[i>>6]|=(uint64_t)1<<(i&63);
+    }
+  }
+}
+
+uint64_t BitView::word(int begin, int count) const {
+  uint64_t result=0;
+  if(packed==nullptr) {
+    for(int i=0; i<count; i++) {
+      result|=(uint64_t)unpacked->Get(offset+begin+i)<<i;
+    }
+    return result;
+  }
+  int pos=offset+begin;
+  for(int i=0; i<count;) {
+    int shift=pos&7;
+    int take=std::min(8-shift, count-i);
+    result|=(uint64_t)((packed[pos>>3]>>shift)&((1<<take)-1))<<i;
+    i+=take;
+    pos+=take;
+  }
+  return result;
+}
@@ -0,0 +1,51 @@
+#ifndef BITS_H
+#define BITS_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <google/protobuf/repeated_field.h>
+
+/* Proof file formats.  Format 1 stores bit strings as proto2 repeated bools,
+   format 2 packs them LSB first into bytes fields.  Format 3 is format 2
+   with chunked rounds, see ScrambledCircuit::round_blocks. */
+#define FORMAT_UNPACKED 1
+#define FORMAT_PACKED   2
+#define FORMAT_CHUNKED  3
+
+/* Read only view of a bit string, over whichever encoding a message used.
+   A packed view whose byte length does not fit the expected number of bits
+   has size -1, so it never matches anything, as does a default constructed one. */
+class BitView {
+ public:
+  BitView(): unpacked(nullptr), packed(nullptr), offset(0), n(-1) {}
+  BitView(const google::protobuf::RepeatedField<bool>& field): unpacked(&field), packed(nullptr), offset(0), n(field.size()) {}
+  BitView(const std::string& bytes, int nbits): unpacked(nullptr), packed((const unsigned char*)bytes.data()), offset(0), n(bytes.size()==(size_t)(nbits+7)/8 ? nbits : -1) {}
+  BitView(const BitView& whole, int begin, int count): unpacked(whole.unpacked), packed(whole.packed), offset(whole.offset+begin), n(count) {}
+
+  int size() const { return n; }
+
+  bool operator[](int i) const {
+    if(packed!=nullptr) {
+      return (packed[(offset+i)>>3]>>((offset+i)&7))&1;
+    }
+    return unpacked->Get(offset+i);
+  }
+
+  /* Bits [begin,begin+count) as an integer, the first one least significant.  count<=64 */
+  uint64_t word(int begin, int count) const;
+
+ private:
+  const google::protobuf::RepeatedField<bool>* unpacked;
+  const unsigned char* packed;
+  int offset;
+  int n;
+};
+
+void pack_bits(const std::vector<bool>& bits, std::string* out);
+void unpack_bits(const BitView& view, std::vector<bool>& bits);
+/* Packs into 64 bit words, LSB first */
+void pack_words(const std::vector<bool>& bits, std::vector<uint64_t>& words);
+
+#endif //BITS_H
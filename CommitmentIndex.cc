@@ -0,0 +1,55 @@
+#include "CommitmentIndex.h"
+#include "BatchHash.h"
+
+#include <algorithm>
+#include <array>
+#include <string.h>
+
+bool CommitmentIndex::build(const yosysZKP::Commitment& commitment) {
+  int ngates=commitment.gatehashes_size();
+  gatestart.assign(ngates+1, 0);
+  for(int g=0; g<ngates; g++) {
+    gatestart[g+1]=gatestart[g]+commitment.gatehashes(g).entryhashes_size();
+  }
+  int total=gatestart[ngates];
+
+  digests.resize((size_t)total*SHA256_DIGEST_SIZE);
+  typedef std::array<unsigned char, SHA256_DIGEST_SIZE> Digest;
+  std::vector<Digest> gate;
+  for(int g=0; g<ngates; g++) {
+    const yosysZKP::TableCommitment& tc=commitment.gatehashes(g);
+    gate.resize(tc.entryhashes_size());
+    for(int j=0; j<tc.entryhashes_size(); j++) {
+      const std::string& h=tc.entryhashes(j);
+      if(h.size()!=SHA256_DIGEST_SIZE) {
+	return false;
+      }
+      memcpy(gate[j].data(), h.data(), SHA256_DIGEST_SIZE);
+    }
+    std::sort(gate.begin(), gate.end());
+    for(size_t j=0; j<gate.size(); j++) {
+      memcpy(&digests[(size_t)(gatestart[g]+j)*SHA256_DIGEST_SIZE], gate[j].data(), SHA256_DIGEST_SIZE);
+    }
+  }
+  return true;
+}
+
+bool CommitmentIndex::contains(int gate, const unsigned char* digest) const {
+  if(gate<0 || gate+1>=(int)gatestart.size()) {
+    return false;
+  }
+  int lo=gatestart[gate];
+  int hi=gatestart[gate+1];
+  while(lo<hi) {
+    int mid=lo+(hi-lo)/2;
+    int c=memcmp(&digests[(size_t)mid*SHA256_DIGEST_SIZE], digest, SHA256_DIGEST_SIZE);
+    if(c==0) {
+      return true;
+    } else if(c<0) {
+      lo=mid+1;
+    } else {
+      hi=mid;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,24 @@
+#ifndef COMMITMENT_INDEX_H
+#define COMMITMENT_INDEX_H
+
+#include <stdint.h>
+#include <vector>
+
+#include "messages.pb.h"
+
+/* The entry hashes of a commitment copied gate by gate into one flat array,
+   each gate's hashes sorted so checking that a revealed entry was committed
+   to is a binary search over that gate's few entries.  The prover picks the
+   hashes, so nothing here may depend on them being spread out. */
+struct CommitmentIndex {
+  std::vector<unsigned char> digests;
+  /* First digest of each gate, plus one past the last */
+  std::vector<int> gatestart;
+
+  /* Returns false if a hash has the wrong size */
+  bool build(const yosysZKP::Commitment& commitment);
+
+  bool contains(int gate, const unsigned char* digest) const;
+};
+
+#endif //COMMITMENT_INDEX_H
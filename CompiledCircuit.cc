@@ -0,0 +1,105 @@
+#include "CompiledCircuit.h"
+
+USING_YOSYS_NAMESPACE
+
+CompiledCircuit::CompiledCircuit(Module* module): m(module), nbits(0) {
+  m->sort();
+  sigmap.set(m);
+  compile();
+}
+
+CompiledCircuit::CompiledCircuit(const yosysZKP::CircuitFile& file): m(nullptr), nbits(file.nbits()) {
+  int ncells=file.cell_table_size();
+  if(nbits<0 || file.cell_name_size()!=ncells || file.cell_ninputs_size()!=ncells || file.cell_noutputs_size()!=ncells) {
+    log_error("Compiled circuit is damaged\n");
+  }
+
+  portbits.assign(file.portbits().begin(), file.portbits().end());
+  inputs.assign(file.inputs().begin(), file.inputs().end());
+  outputs.assign(file.outputs().begin(), file.outputs().end());
+
+  size_t next=0;
+  for(int i=0; i<ncells; i++) {
+    int table=file.cell_table(i);
+    if(table<0 || table>=file.tables_size() || file.cell_ninputs(i)<0 || file.cell_noutputs(i)<0) {
+      log_error("Compiled circuit is damaged\n");
+    }
+    CompiledCell cc;
+    cc.cell=nullptr;
+    cc.type=file.tables(table).type();
+    cc.name=file.cell_name(i);
+    cc.inputs=next;
+    cc.ninputs=file.cell_ninputs(i);
+    cc.outputs=next+cc.ninputs;
+    cc.noutputs=file.cell_noutputs(i);
+    next+=cc.ninputs+cc.noutputs;
+    cells.push_back(cc);
+  }
+
+  auto valid=[&](const std::vector<int>& bits) {
+    for(int b:bits) {
+      if(b<0 || b>const1()) {
+	return false;
+      }
+    }
+    return true;
+  };
+  if(next!=portbits.size() || !valid(portbits) || !valid(inputs) || !valid(outputs)) {
+    log_error("Compiled circuit is damaged\n");
+  }
+}
+
+int CompiledCircuit::bit_index(const SigBit& bit) const {
+  SigBit b=sigmap(bit);
+  if(b.wire==nullptr) {
+    return b.data==State::S1 ? const1() : const0();
+  }
+  return netindex.at(b);
+}
+
+void CompiledCircuit::compile() {
+  for(Wire* w:m->wires()) {
+    for(int i=0; i<w->width; i++) {
+      SigBit b=sigmap(SigBit(w,i));
+      if(b.wire!=nullptr && !netindex.count(b)) {
+	netindex[b]=nbits++;
+      }
+    }
+  }
+
+  for(IdString s:m->ports) {
+    Wire* w=m->wire(s);
+    for(int i=0; i<w->width; i++) {
+      if(w->port_input) {
+	inputs.push_back(bit_index(SigBit(w,i)));
+      }
+      if(w->port_output) {
+	outputs.push_back(bit_index(SigBit(w,i)));
+      }
+    }
+  }
+
+  for(Cell* cell:m->cells()) {
+    CompiledCell cc;
+    cc.cell=cell;
+    cc.type=cell->type;
+    cc.name=cell->name;
+
+    std::vector<int> in, out;
+    for(auto& it:cell->connections()) {
+      std::vector<int>& dest=cell->input(it.first)?in:out;
+      for(const SigBit& b:it.second) {
+	dest.push_back(bit_index(b));
+      }
+    }
+
+    cc.inputs=portbits.size();
+    cc.ninputs=in.size();
+    portbits.insert(portbits.end(), in.begin(), in.end());
+    cc.outputs=portbits.size();
+    cc.noutputs=out.size();
+    portbits.insert(portbits.end(), out.begin(), out.end());
+
+    cells.push_back(cc);
+  }
+}
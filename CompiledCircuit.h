@@ -0,0 +1,56 @@
+#ifndef COMPILED_CIRCUIT_H
+#define COMPILED_CIRCUIT_H
+
+#include <kernel/yosys.h>
+#include <kernel/sigtools.h>
+#include <vector>
+
+#include "messages.pb.h"
+
+/* One gate of the flattened netlist. Its ports are ranges of
+   CompiledCircuit::portbits, inputs and outputs each in port name order.
+   cell is null for circuits loaded from a compiled file. */
+struct CompiledCell {
+  Yosys::Cell* cell;
+  Yosys::IdString type;
+  Yosys::IdString name;
+  int inputs;
+  int ninputs;
+  int outputs;
+  int noutputs;
+};
+
+/* Flat view of a module with every net given a dense index.  Nets are
+   numbered by their first wire bit in wire name order, LSB first, which is
+   also the order they are serialized in.  Wire bits connected by the module's
+   assignments share a net.  The two constant bits get the indices just past
+   the nets. */
+struct CompiledCircuit {
+  Yosys::Module* m;
+
+  int nbits;
+
+  std::vector<CompiledCell> cells;
+  std::vector<int> portbits;
+
+  std::vector<int> inputs;
+  std::vector<int> outputs;
+
+  CompiledCircuit(Yosys::Module* module);
+  /* The netlist of a compiled file, with no module behind it, so bit_index
+     is not available.  Checks that every port refers to a net. */
+  CompiledCircuit(const yosysZKP::CircuitFile& file);
+
+  int const0() const { return nbits; }
+  int const1() const { return nbits+1; }
+
+  int bit_index(const Yosys::SigBit& b) const;
+
+private:
+  Yosys::SigMap sigmap;
+  Yosys::dict<Yosys::SigBit, int> netindex;
+
+  void compile();
+};
+
+#endif //COMPILED_CIRCUIT_H
@@ -0,0 +1,268 @@
+#include "Daemon.h"
+#include "messages.pb.h"
+
+#include <kernel/yosys.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+USING_YOSYS_NAMESPACE
+
+/* Larger requests or responses are taken for garbage */
+static const uint64_t MAX_MESSAGE_BYTES=1<<30;
+
+static bool write_all(int fd, const char* data, size_t n) {
+  while(n>0) {
+    ssize_t w=write(fd, data, n);
+    if(w<0 && errno==EINTR) {
+      continue;
+    }
+    if(w<=0) {
+      return false;
+    }
+    data+=w;
+    n-=w;
+  }
+  return true;
+}
+
+static bool read_all(int fd, char* data, size_t n) {
+  while(n>0) {
+    ssize_t r=read(fd, data, n);
+    if(r<0 && errno==EINTR) {
+      continue;
+    }
+    if(r<=0) {
+      return false;
+    }
+    data+=r;
+    n-=r;
+  }
+  return true;
+}
+
+bool Daemon_send(int fd, const google::protobuf::MessageLite& msg) {
+  std::string buf;
+  msg.SerializeToString(&buf);
+  unsigned char length[8];
+  for(int i=0; i<8; i++) {
+    length[i]=(uint64_t(buf.size())>>(8*i))&0xff;
+  }
+  return write_all(fd, (const char*)length, sizeof(length)) && write_all(fd, buf.data(), buf.size());
+}
+
+bool Daemon_receive(int fd, google::protobuf::MessageLite* msg) {
+  unsigned char length[8];
+  if(!read_all(fd, (char*)length, sizeof(length))) {
+    return false;
+  }
+  uint64_t n=0;
+  for(int i=7; i>=0; i--) {
+    n=(n<<8)|length[i];
+  }
+  if(n>MAX_MESSAGE_BYTES) {
+    return false;
+  }
+  std::string buf(n, 0);
+  return read_all(fd, &buf[0], n) && msg->ParseFromString(buf);
+}
+
+static bool socket_address(const std::string& path, sockaddr_un& addr) {
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family=AF_UNIX;
+  if(path.size()>=sizeof(addr.sun_path)) {
+    return false;
+  }
+  strcpy(addr.sun_path, path.c_str());
+  return true;
+}
+
+/* Runs one request in a child writing to a temporary file, which becomes
+   the output of the response.  The child names its action over a pipe. */
+static yosysZKP::DaemonResponse run_child(const yosysZKP::DaemonRequest& request, DaemonAction run, std::string& action) {
+  yosysZKP::DaemonResponse response;
+  response.set_status(1);
+
+  FILE* out=tmpfile();
+  if(out==nullptr) {
+    response.set_output(stringf("Could not create an output file: %s\n", strerror(errno)));
+    return response;
+  }
+  int name[2];
+  if(pipe(name)!=0) {
+    response.set_output(stringf("Could not create a pipe: %s\n", strerror(errno)));
+    fclose(out);
+    return response;
+  }
+
+  std::cout.flush();
+  fflush(stdout);
+  pid_t pid=fork();
+  if(pid==0) {
+    close(name[0]);
+    dup2(fileno(out), STDOUT_FILENO);
+    dup2(fileno(out), STDERR_FILENO);
+    int status=1;
+    if(!request.cwd().empty() && chdir(request.cwd().c_str())!=0) {
+      fprintf(stderr, "Could not change to %s: %s\n", request.cwd().c_str(), strerror(errno));
+    } else {
+      int fd=name[1];
+      status=run(std::vector<std::string>(request.args().begin(), request.args().end()),
+		 [fd](const std::string& started) { write_all(fd, started.data(), started.size()); });
+    }
+    std::cout.flush();
+    fflush(stdout);
+    _exit(status);
+  }
+
+  close(name[1]);
+  if(pid<0) {
+    response.set_output(stringf("Could not fork: %s\n", strerror(errno)));
+  } else {
+    //The name is short enough for the pipe buffer, so the child never blocks on it
+    int wstatus;
+    while(waitpid(pid, &wstatus, 0)<0 && errno==EINTR) {
+    }
+    char c;
+    ssize_t r;
+    while((r=read(name[0], &c, 1))>0 || (r<0 && errno==EINTR)) {
+      if(r>0) {
+	action.push_back(c);
+      }
+    }
+    response.set_status(WIFEXITED(wstatus) ? WEXITSTATUS(wstatus) : 128+WTERMSIG(wstatus));
+
+    std::string output;
+    char buf[65536];
+    rewind(out);
+    size_t n;
+    while((n=fread(buf, 1, sizeof(buf), out))>0) {
+      output.append(buf, n);
+    }
+    response.set_output(output);
+  }
+  close(name[0]);
+  fclose(out);
+  return response;
+}
+
+static void serve_session(int conn, DaemonAction run) {
+  yosysZKP::DaemonRequest request;
+  while(Daemon_receive(conn, &request)) {
+    auto start=std::chrono::steady_clock::now();
+    std::string action;
+    yosysZKP::DaemonResponse response=run_child(request, run, action);
+    response.set_seconds(std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count());
+
+    log("[%d] %s: status %d in %.3f s\n", getpid(), action.empty() ? "(unknown)" : action.c_str(),
+	response.status(), response.seconds());
+    std::cout.flush();
+    if(!Daemon_send(conn, response)) {
+      break;
+    }
+  }
+  close(conn);
+}
+
+void Daemon_serve(const std::string& path, DaemonAction run) {
+  sockaddr_un addr;
+  if(!socket_address(path, addr)) {
+    log_error("Socket path %s is too long\n", path.c_str());
+  }
+  //Only a stale socket is removed, never some other file
+  struct stat st;
+  if(stat(path.c_str(), &st)==0 && S_ISSOCK(st.st_mode)) {
+    unlink(path.c_str());
+  }
+
+  //Requests write files as the daemon, so only its user may connect
+  int sock=socket(AF_UNIX, SOCK_STREAM, 0);
+  mode_t mask=umask(077);
+  bool bound=sock>=0 && bind(sock, (sockaddr*)&addr, sizeof(addr))==0;
+  umask(mask);
+  if(!bound || chmod(path.c_str(), 0600)!=0 || listen(sock, 64)!=0) {
+    log_error("Could not listen on %s: %s\n", path.c_str(), strerror(errno));
+  }
+
+  //Clients hanging up must not kill a session, and sessions reap themselves
+  signal(SIGPIPE, SIG_IGN);
+  signal(SIGCHLD, SIG_IGN);
+  log("Serving on %s\n", path.c_str());
+  std::cout.flush();
+
+  while(true) {
+    int conn=accept(sock, nullptr, nullptr);
+    if(conn<0) {
+      if(errno==EINTR || errno==ECONNABORTED) {
+	continue;
+      }
+      log_error("Could not accept on %s: %s\n", path.c_str(), strerror(errno));
+    }
+    ucred peer;
+    socklen_t len=sizeof(peer);
+    if(getsockopt(conn, SOL_SOCKET, SO_PEERCRED, &peer, &len)!=0 || peer.uid!=getuid()) {
+      log_warning("Refused a connection from another user\n");
+      close(conn);
+      continue;
+    }
+
+    std::cout.flush();
+    fflush(stdout);
+    pid_t pid=fork();
+    if(pid==0) {
+      close(sock);
+      //The session waits for its requests itself
+      signal(SIGCHLD, SIG_DFL);
+      serve_session(conn, run);
+      std::cout.flush();
+      _exit(0);
+    }
+    if(pid<0) {
+      log_warning("Could not fork a session: %s\n", strerror(errno));
+    }
+    close(conn);
+  }
+}
+
+int Daemon_request(const std::string& path, const std::vector<std::string>& args) {
+  sockaddr_un addr;
+  if(!socket_address(path, addr)) {
+    fprintf(stderr, "Socket path %s is too long\n", path.c_str());
+    return 1;
+  }
+  int sock=socket(AF_UNIX, SOCK_STREAM, 0);
+  if(sock<0 || connect(sock, (sockaddr*)&addr, sizeof(addr))!=0) {
+    fprintf(stderr, "Could not connect to %s: %s\n", path.c_str(), strerror(errno));
+    return 1;
+  }
+
+  yosysZKP::DaemonRequest request;
+  for(const std::string& arg:args) {
+    request.add_args(arg);
+  }
+  char* cwd=getcwd(nullptr, 0);
+  if(cwd!=nullptr) {
+    request.set_cwd(cwd);
+    free(cwd);
+  }
+
+  yosysZKP::DaemonResponse response;
+  if(!Daemon_send(sock, request) || !Daemon_receive(sock, &response)) {
+    fprintf(stderr, "The daemon at %s hung up\n", path.c_str());
+    close(sock);
+    return 1;
+  }
+  close(sock);
+
+  fwrite(response.output().data(), 1, response.output().size(), stdout);
+  fprintf(stderr, "Daemon took %.3f s\n", response.seconds());
+  return response.status();
+}
@@ -0,0 +1,31 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <google/protobuf/message_lite.h>
+
+/* Messages on a daemon socket are framed like those in the files: a 64 bit
+   little endian length, then the message.  Both return false once the
+   other end is gone or sent something that does not parse. */
+bool Daemon_send(int fd, const google::protobuf::MessageLite& msg);
+bool Daemon_receive(int fd, google::protobuf::MessageLite* msg);
+
+/* Runs the args of a request, calling started with the name of its action
+   once the command line is parsed */
+typedef std::function<int(const std::vector<std::string>& args, std::function<void(const std::string&)> started)> DaemonAction;
+
+/* Serves DaemonRequests on a Unix domain socket at path, never returning.
+   Every connection gets a process of its own, so sessions run concurrently,
+   and every request runs run(args) in a further child with its output
+   captured.  Whatever the daemon loaded before is shared copy on write, and
+   an action failing with log_error only takes its child down. */
+[[noreturn]] void Daemon_serve(const std::string& path, DaemonAction run);
+
+/* Client side: runs args on the daemon at path, prints the output and
+   returns the exit status of the action */
+int Daemon_request(const std::string& path, const std::vector<std::string>& args);
+
+#endif //DAEMON_H
@@ -0,0 +1,312 @@
+#include "Evaluator.h"
+
+#include <algorithm>
+
+USING_YOSYS_NAMESPACE
+
+static const struct {
+  const char* type;
+  int ninputs;
+  EvalOpType op;
+} eval_celltypes[] = {
+  {"$_BUF_",     1, EVAL_BUF},
+  {"$_NOT_",     1, EVAL_NOT},
+  {"$_AND_",     2, EVAL_AND},
+  {"$_NAND_",    2, EVAL_NAND},
+  {"$_OR_",      2, EVAL_OR},
+  {"$_NOR_",     2, EVAL_NOR},
+  {"$_XOR_",     2, EVAL_XOR},
+  {"$_XNOR_",    2, EVAL_XNOR},
+  {"$_ANDNOT_",  2, EVAL_ANDNOT},
+  {"$_ORNOT_",   2, EVAL_ORNOT},
+  {"$_MUX_",     3, EVAL_MUX},
+  {"$_NMUX_",    3, EVAL_NMUX},
+  {"$_AOI3_",    3, EVAL_AOI3},
+  {"$_OAI3_",    3, EVAL_OAI3},
+  {"$_AOI4_",    4, EVAL_AOI4},
+  {"$_OAI4_",    4, EVAL_OAI4},
+  //Word level cells, accepted only when every port is a single bit
+  {"$pos",         1, EVAL_BUF},
+  {"$not",         1, EVAL_NOT},
+  {"$logic_not",   1, EVAL_NOT},
+  {"$reduce_and",  1, EVAL_BUF},
+  {"$reduce_or",   1, EVAL_BUF},
+  {"$reduce_bool", 1, EVAL_BUF},
+  {"$reduce_xor",  1, EVAL_BUF},
+  {"$reduce_xnor", 1, EVAL_NOT},
+  {"$and",         2, EVAL_AND},
+  {"$logic_and",   2, EVAL_AND},
+  {"$or",          2, EVAL_OR},
+  {"$logic_or",    2, EVAL_OR},
+  {"$xor",         2, EVAL_XOR},
+  {"$xnor",        2, EVAL_XNOR},
+  {"$eq",          2, EVAL_XNOR},
+  {"$ne",          2, EVAL_XOR},
+  {"$mux",         3, EVAL_MUX},
+};
+
+static inline void set_lane(EvalWord& w, int lane) {
+  w[lane/64] |= (uint64_t)1<<(lane%64);
+}
+
+static inline bool get_lane(const EvalWord& w, int lane) {
+  return (w[lane/64]>>(lane%64))&1;
+}
+
+Evaluator::Evaluator(const CompiledCircuit& circuit): c(circuit), supported(false) {
+
+}
+
+void Evaluator::compile(const std::vector<const CanonicalTable*>& tables) {
+  ops.clear();
+  supported=true;
+  for(size_t i=0; i<c.cells.size(); i++) {
+    EvalOp op;
+    if(!compile_cell(c.cells[i], *tables[i], op)) {
+      supported=false;
+      return;
+    }
+    ops.push_back(op);
+  }
+  levelize();
+}
+
+bool Evaluator::compile_cell(const CompiledCell& cell, const CanonicalTable& table, EvalOp& op) {
+  if(cell.noutputs!=1 || cell.ninputs>EVAL_LUT_INPUTS) {
+    return false;
+  }
+  op.type=EVAL_LUT;
+  op.truth=0;
+  for(const auto& t:eval_celltypes) {
+    if(cell.type==t.type) {
+      if(cell.ninputs!=t.ninputs) {
+	return false;
+      }
+      op.type=t.op;
+      break;
+    }
+  }
+  if(op.type==EVAL_LUT) {
+    if(table.ninputs!=cell.ninputs || table.noutputs!=1) {
+      return false;
+    }
+    for(int k=0; k<(1<<cell.ninputs); k++) {
+      op.truth|=(table.outputs[k]&1)<<k;
+    }
+  }
+  for(int i=0; i<EVAL_LUT_INPUTS; i++) {
+    op.in[i]=i<cell.ninputs ? c.portbits[cell.inputs+i] : c.const0();
+  }
+  op.out=c.portbits[cell.outputs];
+  return op.out<c.nbits;
+}
+
+/* Shannon expansion of the truth table, one input at a time.  Unused inputs
+   are tied to const0, so they select the lower half. */
+template<typename W>
+static inline void eval_lut(uint16_t truth, const W& a, const W& b, const W& s, const W& d, W& y) {
+  const W zero=a^a;
+  W v[16];
+  for(int k=0; k<16; k++) {
+    v[k]=(truth>>k)&1 ? ~zero : zero;
+  }
+  const W* sel[EVAL_LUT_INPUTS]={&a, &b, &s, &d};
+  for(int i=0, n=16; i<EVAL_LUT_INPUTS; i++, n/=2) {
+    for(int k=0; k<n/2; k++) {
+      v[k]=(v[2*k]&~*sel[i])|(v[2*k+1]&*sel[i]);
+    }
+  }
+  y=v[0];
+}
+
+void Evaluator::levelize() {
+  int nnets=c.nbits+2;
+
+  std::vector<int> driver(nnets, -1);
+  for(size_t i=0; i<ops.size(); i++) {
+    if(driver[ops[i].out]!=-1) {
+      supported=false;
+      return;
+    }
+    driver[ops[i].out]=i;
+  }
+
+  std::vector<bool> driven(nnets, false);
+  driven[c.const0()]=true;
+  driven[c.const1()]=true;
+  for(int i:c.inputs) {
+    driven[i]=true;
+  }
+  for(int n=0; n<c.nbits; n++) {
+    if(!driven[n] && driver[n]==-1) {
+      supported=false;
+      return;
+    }
+  }
+
+  //Kahn's algorithm over the nets driven by other ops
+  std::vector<int> pending(ops.size(), 0);
+  std::vector<int> fanstart(nnets+1, 0);
+  for(size_t i=0; i<ops.size(); i++) {
+    for(int in:ops[i].in) {
+      if(driver[in]!=-1) {
+	fanstart[in+1]++;
+	pending[i]++;
+      }
+    }
+  }
+  for(int n=0; n<nnets; n++) {
+    fanstart[n+1]+=fanstart[n];
+  }
+  std::vector<int> fanout(fanstart[nnets]);
+  {
+    std::vector<int> fill(fanstart.begin(), fanstart.end()-1);
+    for(size_t i=0; i<ops.size(); i++) {
+      for(int in:ops[i].in) {
+	if(driver[in]!=-1) {
+	  fanout[fill[in]++]=i;
+	}
+      }
+    }
+  }
+
+  std::vector<int> netlevel(nnets, 0);
+  std::vector<int> oplevel(ops.size(), 0);
+  std::vector<int> queue;
+  for(size_t i=0; i<ops.size(); i++) {
+    if(pending[i]==0) {
+      queue.push_back(i);
+    }
+  }
+  int maxlevel=0;
+  for(size_t q=0; q<queue.size(); q++) {
+    int i=queue[q];
+    int level=0;
+    for(int in:ops[i].in) {
+      level=std::max(level, netlevel[in]);
+    }
+    oplevel[i]=level;
+    netlevel[ops[i].out]=level+1;
+    maxlevel=std::max(maxlevel, level);
+    int out=ops[i].out;
+    for(int f=fanstart[out]; f<fanstart[out+1]; f++) {
+      if(--pending[fanout[f]]==0) {
+	queue.push_back(fanout[f]);
+      }
+    }
+  }
+  if(queue.size()!=ops.size()) {
+    //Combinational loop
+    supported=false;
+    return;
+  }
+
+  //Counting sort, fill[l] is where the next op of level l goes
+  std::vector<int> fill(maxlevel+2, 0);
+  for(size_t i=0; i<ops.size(); i++) {
+    fill[oplevel[i]+1]++;
+  }
+  for(int l=0; l<=maxlevel; l++) {
+    fill[l+1]+=fill[l];
+  }
+  std::vector<EvalOp> sorted(ops.size());
+  for(size_t i=0; i<ops.size(); i++) {
+    sorted[fill[oplevel[i]]++]=ops[i];
+  }
+  ops.swap(sorted);
+}
+
+template<typename W>
+void Evaluator::run(W* n) const {
+  for(const EvalOp& op:ops) {
+    const W a=n[op.in[0]];
+    const W b=n[op.in[1]];
+    const W s=n[op.in[2]];
+    const W d=n[op.in[3]];
+    W y;
+    switch(op.type) {
+    case EVAL_BUF:    y=a; break;
+    case EVAL_NOT:    y=~a; break;
+    case EVAL_AND:    y=a&b; break;
+    case EVAL_NAND:   y=~(a&b); break;
+    case EVAL_OR:     y=a|b; break;
+    case EVAL_NOR:    y=~(a|b); break;
+    case EVAL_XOR:    y=a^b; break;
+    case EVAL_XNOR:   y=~(a^b); break;
+    case EVAL_ANDNOT: y=a&~b; break;
+    case EVAL_ORNOT:  y=a|~b; break;
+    case EVAL_MUX:    y=(a&~s)|(b&s); break;
+    case EVAL_NMUX:   y=~((a&~s)|(b&s)); break;
+    case EVAL_AOI3:   y=~((a&b)|s); break;
+    case EVAL_OAI3:   y=~((a|b)&s); break;
+    case EVAL_AOI4:   y=~((a&b)|(s&d)); break;
+    case EVAL_OAI4:   y=~((a|b)&(s|d)); break;
+    case EVAL_LUT:    eval_lut(op.truth, a, b, s, d, y); break;
+    default:          y=a; break;
+    }
+    n[op.out]=y;
+  }
+}
+
+void Evaluator::execute(const Const& inputs, WireValues& values) const {
+  if(inputs.size()!=(int)c.inputs.size()) {
+    log_error("Circuit takes %d input bits but %d were given\n", (int)c.inputs.size(), inputs.size());
+  }
+
+  std::vector<uint64_t> n(c.nbits+2, 0);
+  n[c.const1()]=~(uint64_t)0;
+  for(size_t i=0; i<c.inputs.size(); i++) {
+    n[c.inputs[i]]=(inputs[i]==State::S1);
+  }
+
+  run(n.data());
+
+  for(int i=0; i<c.nbits; i++) {
+    values.bits[i]=n[i]&1;
+  }
+}
+
+std::vector<Const> Evaluator::execute_batch(const std::vector<Const>& inputs, std::vector<WireValues>* values) const {
+  std::vector<Const> result(inputs.size());
+  if(values!=nullptr) {
+    values->assign(inputs.size(), WireValues(c));
+  }
+
+  const EvalWord zero={};
+  //std::vector does not honour the vector alignment before C++17
+  std::vector<uint64_t> storage((c.nbits+3)*sizeof(EvalWord)/sizeof(uint64_t));
+  EvalWord* n=reinterpret_cast<EvalWord*>(((uintptr_t)storage.data()+sizeof(EvalWord)-1) & ~(uintptr_t)(sizeof(EvalWord)-1));
+  for(size_t base=0; base<inputs.size(); base+=EVAL_LANES) {
+    int lanes=std::min((size_t)EVAL_LANES, inputs.size()-base);
+
+    std::fill(n, n+c.nbits+2, zero);
+    n[c.const1()]=~zero;
+    for(int l=0; l<lanes; l++) {
+      const Const& in=inputs[base+l];
+      if(in.size()!=(int)c.inputs.size()) {
+	log_error("Circuit takes %d input bits but %d were given\n", (int)c.inputs.size(), in.size());
+      }
+      for(size_t i=0; i<c.inputs.size(); i++) {
+	if(in[i]==State::S1) {
+	  set_lane(n[c.inputs[i]], l);
+	}
+      }
+    }
+
+    run(n);
+
+    for(int l=0; l<lanes; l++) {
+      Const& out=result[base+l];
+      for(int o:c.outputs) {
+	out.bits.push_back(get_lane(n[o], l) ? State::S1 : State::S0);
+      }
+      if(values!=nullptr) {
+	WireValues& v=(*values)[base+l];
+	for(int i=0; i<c.nbits; i++) {
+	  v.bits[i]=get_lane(n[i], l);
+	}
+      }
+    }
+  }
+  return result;
+}
@@ -0,0 +1,64 @@
+#ifndef EVALUATOR_H
+#define EVALUATOR_H
+
+#include <kernel/yosys.h>
+#include <stdint.h>
+
+#include "CompiledCircuit.h"
+#include "TruthTable.h"
+#include "WireValues.h"
+
+/* 256 evaluations side by side, one per bit lane.  GCC lowers the vector
+   operations to AVX2 or SSE depending on the target. */
+typedef uint64_t EvalWord __attribute__((vector_size(32)));
+#define EVAL_LANES 256
+
+enum EvalOpType {
+  EVAL_BUF, EVAL_NOT, EVAL_AND, EVAL_NAND, EVAL_OR, EVAL_NOR, EVAL_XOR, EVAL_XNOR,
+  EVAL_ANDNOT, EVAL_ORNOT, EVAL_MUX, EVAL_NMUX, EVAL_AOI3, EVAL_OAI3, EVAL_AOI4, EVAL_OAI4,
+  EVAL_LUT
+};
+
+#define EVAL_LUT_INPUTS 4
+
+struct EvalOp {
+  unsigned char type;
+  /* EVAL_LUT: output for input number k in bit k, in[0] the LSB */
+  uint16_t truth;
+  int in[EVAL_LUT_INPUTS];
+  int out;
+};
+
+/* Levelized, bit-sliced evaluator over the single bit gates of a
+   CompiledCircuit, and any other cell with at most EVAL_LUT_INPUTS inputs and
+   one output, which is evaluated as a LUT of its canonical table.  If the
+   circuit contains anything else (wide cells, loops, undriven nets)
+   supported is false and callers fall back to ConstEval. */
+struct Evaluator {
+  const CompiledCircuit& c;
+
+  bool supported;
+
+  /* Sorted by level, so each op comes after those driving its inputs */
+  std::vector<EvalOp> ops;
+
+  /* Nothing is supported until compile() */
+  Evaluator(const CompiledCircuit& circuit);
+
+  /* Builds the ops, tables indexed like the circuit's cells */
+  void compile(const std::vector<const CanonicalTable*>& tables);
+
+  void execute(const Yosys::Const& inputs, WireValues& values) const;
+
+  /* Evaluates many input assignments in one pass, EVAL_LANES at a time.
+     Returns the outputs for each, and optionally every net's value. */
+  std::vector<Yosys::Const> execute_batch(const std::vector<Yosys::Const>& inputs, std::vector<WireValues>* values=nullptr) const;
+
+private:
+  bool compile_cell(const CompiledCell& cell, const CanonicalTable& table, EvalOp& op);
+  void levelize();
+
+  template<typename W> void run(W* nets) const;
+};
+
+#endif //EVALUATOR_H
@@ -0,0 +1,52 @@
+#include "FiatShamir.h"
+#include "Bits.h"
+#include "KeystreamRNG.h"
+
+USING_YOSYS_NAMESPACE
+using namespace CryptoPP;
+
+static const char fiat_shamir_domain[]="yosysZKP fiat-shamir v1";
+
+ChallengeHasher::ChallengeHasher(const std::string& circuit, const Const& outputs, int rounds): rounds(rounds) {
+  sha.Update((const byte*)fiat_shamir_domain, sizeof(fiat_shamir_domain));
+
+  add_length(circuit.size());
+  sha.Update((const byte*)circuit.data(), circuit.size());
+
+  std::vector<bool> bits;
+  for(State s:outputs.bits) {
+    bits.push_back(s==State::S1);
+  }
+  std::string packed;
+  pack_bits(bits, &packed);
+  add_length(bits.size());
+  sha.Update((const byte*)packed.data(), packed.size());
+
+  add_length(rounds);
+}
+
+void ChallengeHasher::add_length(uint64_t n) {
+  byte b[8];
+  for(int i=0; i<8; i++) {
+    b[i]=n>>(8*i);
+  }
+  sha.Update(b, sizeof(b));
+}
+
+void ChallengeHasher::add_commitment(const char* raw, size_t size) {
+  add_length(size);
+  sha.Update((const byte*)raw, size);
+}
+
+std::vector<bool> ChallengeHasher::challenges() {
+  byte digest[SHA256::DIGESTSIZE];
+  sha.Final(digest);
+
+  KeystreamRNG rng;
+  rng.Seed(digest);
+  std::vector<bool> result(rounds);
+  for(int i=0; i<rounds; i++) {
+    result[i]=rng.GenerateBit();
+  }
+  return result;
+}
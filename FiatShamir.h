@@ -0,0 +1,30 @@
+#ifndef FIAT_SHAMIR_H
+#define FIAT_SHAMIR_H
+
+#include <kernel/yosys.h>
+#include <crypto++/sha.h>
+
+#include <string>
+#include <vector>
+
+/* Derives the reveal requests of a non-interactive proof from the statement
+   and the whole commitment stream, so a prover cannot choose its commitments
+   after seeing the challenges.  Both sides feed it the serialized commitments
+   exactly as they appear in the proof file. */
+class ChallengeHasher {
+ public:
+  ChallengeHasher(const std::string& circuit, const Yosys::Const& outputs, int rounds);
+
+  void add_commitment(const char* raw, size_t size);
+
+  /* One bit per round, true meaning the scrambling is revealed */
+  std::vector<bool> challenges();
+
+ private:
+  CryptoPP::SHA256 sha;
+  int rounds;
+
+  void add_length(uint64_t n);
+};
+
+#endif //FIAT_SHAMIR_H
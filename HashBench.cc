@@ -0,0 +1,60 @@
+#include "TruthTable.h"
+#include "BatchHash.h"
+
+#include <chrono>
+#include <string.h>
+
+#include <crypto++/osrng.h>
+#include <crypto++/sha.h>
+
+using namespace CryptoPP;
+
+/* Compares hashing truth table entries one protobuf serialization and
+   SHA256 call at a time with the batch engine used by the prover and verifier */
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+}
+
+int main(int argc, char** argv) {
+  int count=argc>1 ? atoi(argv[1]) : 1000000;
+  int ninputs=argc>2 ? atoi(argv[2]) : 2;
+
+  AutoSeededRandomPool rand;
+  std::vector<yosysZKP::TruthTableEntry> entries(count);
+  for(yosysZKP::TruthTableEntry& e:entries) {
+    for(int i=0; i<ninputs; i++) {
+      e.add_inputs(rand.GenerateBit());
+    }
+    e.add_outputs(rand.GenerateBit());
+    std::string* nonce=e.mutable_nonce();
+    nonce->resize(NONCE_SIZE);
+    rand.GenerateBlock((byte*)nonce->data(), NONCE_SIZE);
+  }
+
+  std::vector<unsigned char> old(count*SHA256::DIGESTSIZE);
+  auto start=std::chrono::steady_clock::now();
+  for(int i=0; i<count; i++) {
+    std::string serialized=entries[i].SerializeAsString();
+    SHA256().CalculateDigest(&old[i*SHA256::DIGESTSIZE], (const byte*)serialized.data(), serialized.length());
+  }
+  double oldtime=seconds_since(start);
+
+  std::vector<const yosysZKP::TruthTableEntry*> ptrs;
+  for(const yosysZKP::TruthTableEntry& e:entries) {
+    ptrs.push_back(&e);
+  }
+  std::vector<unsigned char> batch(count*SHA256::DIGESTSIZE);
+  start=std::chrono::steady_clock::now();
+  TruthTableEntry_get_commitments(ptrs, batch.data());
+  double batchtime=seconds_since(start);
+
+  if(memcmp(old.data(), batch.data(), old.size())!=0) {
+    printf("FAIL: batch digests differ from the serialize and hash path\n");
+    return 1;
+  }
+
+  printf("{\"entries\": %d, \"inputs\": %d, \"serialize_sha256_s\": %.6f, \"batch_s\": %.6f, \"speedup\": %.2f}\n",
+	 count, ninputs, oldtime, batchtime, oldtime/batchtime);
+  return 0;
+}
@@ -0,0 +1,85 @@
+#include "KeystreamRNG.h"
+
+#include <algorithm>
+#include <string.h>
+
+#include <crypto++/osrng.h>
+#include <crypto++/sha.h>
+
+#include "Stats.h"
+
+using namespace CryptoPP;
+
+KeystreamRNG::KeystreamRNG(): zeros(BUFFER_SIZE, 0), buffer(BUFFER_SIZE), pos(BUFFER_SIZE), bits(0), nbits(0) {
+}
+
+void KeystreamRNG::Seed(const byte* seed) {
+  byte iv[AES::BLOCKSIZE];
+  memset(iv, 0, sizeof(iv));
+  cipher.SetKeyWithIV(seed, SEED_SIZE, iv, sizeof(iv));
+  pos=BUFFER_SIZE;
+  nbits=0;
+}
+
+void KeystreamRNG::Reseed(byte* seedout) {
+  byte seed[SEED_SIZE];
+  OS_GenerateRandomBlock(false, seed, SEED_SIZE);
+  stats_add(STAT_RNG_BYTES, SEED_SIZE);
+  Seed(seed);
+  if(seedout!=nullptr) {
+    memcpy(seedout, seed, SEED_SIZE);
+  }
+}
+
+void KeystreamRNG::SeedFrom(const std::string& key, uint64_t index, byte* seedout) {
+  byte seed[SEED_SIZE];
+  byte idx[8];
+  for(int i=0; i<8; i++) {
+    idx[i]=index>>(8*i);
+  }
+  SHA256 sha;
+  sha.Update((const byte*)key.data(), key.size());
+  sha.Update(idx, sizeof(idx));
+  sha.Final(seed);
+  Seed(seed);
+  if(seedout!=nullptr) {
+    memcpy(seedout, seed, SEED_SIZE);
+  }
+}
+
+void KeystreamRNG::refill() {
+  cipher.ProcessData(buffer.data(), zeros.data(), BUFFER_SIZE);
+  stats_add(STAT_RNG_BYTES, BUFFER_SIZE);
+  pos=0;
+}
+
+void KeystreamRNG::GenerateBlock(byte* output, size_t size) {
+  while(size>0) {
+    if(pos==BUFFER_SIZE) {
+      refill();
+    }
+    size_t n=std::min(size, (size_t)BUFFER_SIZE-pos);
+    memcpy(output, &buffer[pos], n);
+    pos+=n;
+    output+=n;
+    size-=n;
+  }
+}
+
+byte KeystreamRNG::GenerateByte() {
+  if(pos==BUFFER_SIZE) {
+    refill();
+  }
+  return buffer[pos++];
+}
+
+unsigned int KeystreamRNG::GenerateBit() {
+  if(nbits==0) {
+    GenerateBlock((byte*)&bits, sizeof(bits));
+    nbits=64;
+  }
+  unsigned int b=bits&1;
+  bits>>=1;
+  nbits--;
+  return b;
+}
@@ -0,0 +1,47 @@
+#ifndef KEYSTREAM_RNG_H
+#define KEYSTREAM_RNG_H
+
+#include <crypto++/cryptlib.h>
+#include <crypto++/aes.h>
+#include <crypto++/modes.h>
+
+#include <string>
+#include <vector>
+
+/* Expands a 32 byte seed with AES-256 in counter mode and hands the keystream
+   out of a large buffer.  A proof round seeds it once from the OS, then draws
+   all its key bits, nonces and shuffles from it, so the same seed always
+   gives the same round. */
+class KeystreamRNG : public CryptoPP::RandomNumberGenerator {
+ public:
+  enum { SEED_SIZE=32, BUFFER_SIZE=4096 };
+
+  /* Unseeded, every user seeds it with one of the below before drawing */
+  KeystreamRNG();
+
+  void Seed(const unsigned char* seed);
+  /* Seeds from the operating system, optionally returning the seed used */
+  void Reseed(unsigned char* seedout=nullptr);
+  /* Seeds with the hash of key and index.  With a secret key, such as the
+     seed of a round, this derives independent keystreams from it; with a
+     known one it is only good for repeatable benchmark runs, a proof built
+     this way proves nothing to anyone who knows the key. */
+  void SeedFrom(const std::string& key, uint64_t index, unsigned char* seedout=nullptr);
+
+  void GenerateBlock(unsigned char* output, size_t size);
+  unsigned char GenerateByte();
+  unsigned int GenerateBit();
+
+ private:
+  CryptoPP::CTR_Mode<CryptoPP::AES>::Encryption cipher;
+  std::vector<unsigned char> zeros;
+  std::vector<unsigned char> buffer;
+  size_t pos;
+
+  uint64_t bits;
+  int nbits;
+
+  void refill();
+};
+
+#endif //KEYSTREAM_RNG_H
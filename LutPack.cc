@@ -0,0 +1,268 @@
+#include "LutPack.h"
+#include "BatchHash.h"
+#include "TableCache.h"
+
+#include <chrono>
+#include <kernel/sigtools.h>
+
+USING_YOSYS_NAMESPACE
+
+//Protobuf framing: a tag and a one byte length for each small field
+static const int DIGEST_FIELD_BYTES=2+SHA256_DIGEST_SIZE;
+static const int NONCE_FIELD_BYTES=2+16;
+static const int MESSAGE_BYTES=3;
+
+void ProofCost::add_cell(int ninputs, int noutputs) {
+  long rows=1L<<ninputs;
+  double entry=MESSAGE_BYTES+NONCE_FIELD_BYTES+2+(ninputs+noutputs+7)/8;
+  cells++;
+  entries+=rows;
+  cellentrybytes+=entry;
+  entrybytes+=rows*entry;
+}
+
+ProofCost& ProofCost::operator+=(const ProofCost& o) {
+  cells+=o.cells;
+  nets+=o.nets;
+  entries+=o.entries;
+  cellentrybytes+=o.cellentrybytes;
+  entrybytes+=o.entrybytes;
+  return *this;
+}
+
+double ProofCost::commitment_bytes() const {
+  return entries*DIGEST_FIELD_BYTES+cells*MESSAGE_BYTES;
+}
+
+double ProofCost::execution_bytes() const {
+  return nets/8.0+cellentrybytes;
+}
+
+double ProofCost::scrambling_bytes() const {
+  return nets/8.0+entrybytes+cells*MESSAGE_BYTES;
+}
+
+double ProofCost::round_bytes() const {
+  return commitment_bytes()+(execution_bytes()+scrambling_bytes())/2;
+}
+
+ProofCost ProofCost_of(const CompiledCircuit& c) {
+  ProofCost cost;
+  cost.nets=c.nbits;
+  for(const CompiledCell& cell:c.cells) {
+    cost.add_cell(cell.ninputs, cell.noutputs);
+  }
+  return cost;
+}
+
+/* Hashes dominate both sides, entries are a single SHA-256 block */
+static double seconds_per_hash() {
+  static double result=0;
+  if(result==0) {
+    const int count=1<<14;
+    std::vector<unsigned char> data(count*24, 0x5a);
+    std::vector<const unsigned char*> msgs;
+    for(int i=0; i<count; i++) {
+      msgs.push_back(&data[i*24]);
+    }
+    std::vector<unsigned char> digests(count*SHA256_DIGEST_SIZE);
+    auto start=std::chrono::steady_clock::now();
+    sha256_batch(msgs.data(), 24, count, digests.data());
+    result=std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count()/count;
+  }
+  return result;
+}
+
+void ProofCost_report(const char* label, const ProofCost& cost) {
+  log("%s: %ld cells, %ld nets, %ld table entries\n", label, cost.cells, cost.nets, cost.entries);
+  log("  per round: %.0f commitment bytes, %.0f execution / %.0f scrambling reveal bytes\n",
+      cost.commitment_bytes(), cost.execution_bytes(), cost.scrambling_bytes());
+  log("  per round: %ld prover hashes (~%.3f ms), %.0f verifier hashes (~%.3f ms)\n",
+      cost.prover_hashes(), cost.prover_hashes()*seconds_per_hash()*1e3,
+      cost.verifier_hashes(), cost.verifier_hashes()*seconds_per_hash()*1e3);
+}
+
+/* A single output cell with a known function, as a LUT over its input nets */
+struct PackNode {
+  Cell* cell;
+  std::vector<SigBit> inputs;
+  SigBit output;
+  uint32_t truth;
+  bool alive;
+  bool changed;
+};
+
+static bool node_from_cell(Cell* cell, const SigMap& sigmap, int k, PackNode& node) {
+  int ninputs;
+  unsigned truth;
+  if(!TableCache_builtin_truth(cell, ninputs, truth) || ninputs>k) {
+    return false;
+  }
+
+  node.cell=cell;
+  node.truth=truth;
+  node.alive=true;
+  node.changed=false;
+  node.inputs.clear();
+  int noutputs=0;
+
+  auto conns=cell->connections();
+  conns.sort<RTLIL::sort_by_id_str>();
+  for(auto& conn:conns) {
+    for(const SigBit& b:conn.second) {
+      if(cell->input(conn.first)) {
+	node.inputs.push_back(sigmap(b));
+      } else {
+	node.output=sigmap(b);
+	noutputs++;
+      }
+    }
+  }
+  return GetSize(node.inputs)==ninputs && noutputs==1 && node.output.wire!=nullptr;
+}
+
+static double node_bytes(int ninputs) {
+  ProofCost cost;
+  cost.add_cell(ninputs, 1);
+  return cost.round_bytes();
+}
+
+/* Folds c, whose output n only feeds d, into d if that is cheaper.  uses
+   counts the input ports on each net and is kept up to date. */
+static bool try_merge(PackNode& c, PackNode& d, const SigBit& n, int k, dict<SigBit, int>& uses) {
+  std::vector<SigBit> merged;
+  auto add=[&](const SigBit& b) {
+    if(b!=n && std::find(merged.begin(), merged.end(), b)==merged.end()) {
+      merged.push_back(b);
+    }
+  };
+  for(const SigBit& b:d.inputs) {
+    add(b);
+  }
+  for(const SigBit& b:c.inputs) {
+    add(b);
+  }
+  if(GetSize(merged)>k || std::find(merged.begin(), merged.end(), d.output)!=merged.end()) {
+    return false;
+  }
+
+  ProofCost net;
+  net.nets=1;
+  if(node_bytes(merged.size())>=node_bytes(c.inputs.size())+node_bytes(d.inputs.size())+net.round_bytes()) {
+    return false;
+  }
+
+  auto position=[&](const SigBit& b) {
+    return b==n ? -1 : int(std::find(merged.begin(), merged.end(), b)-merged.begin());
+  };
+  std::vector<int> cpos, dpos;
+  for(const SigBit& b:c.inputs) {
+    cpos.push_back(position(b));
+  }
+  for(const SigBit& b:d.inputs) {
+    dpos.push_back(position(b));
+  }
+
+  uint32_t truth=0;
+  for(uint32_t x=0; x<(1u<<merged.size()); x++) {
+    uint32_t ci=0;
+    for(size_t j=0; j<cpos.size(); j++) {
+      ci|=((x>>cpos[j])&1)<<j;
+    }
+    uint32_t cv=(c.truth>>ci)&1;
+    uint32_t di=0;
+    for(size_t j=0; j<dpos.size(); j++) {
+      di|=(dpos[j]<0 ? cv : (x>>dpos[j])&1)<<j;
+    }
+    truth|=((d.truth>>di)&1)<<x;
+  }
+
+  //Inputs c and d shared now count once
+  for(const SigBit& b:merged) {
+    uses[b]-=std::count(c.inputs.begin(), c.inputs.end(), b)+std::count(d.inputs.begin(), d.inputs.end(), b)-1;
+  }
+  uses[n]=0;
+
+  d.inputs=merged;
+  d.truth=truth;
+  d.changed=true;
+  c.alive=false;
+  return true;
+}
+
+void LutPack_run(Module* m, int k) {
+  ProofCost before=ProofCost_of(CompiledCircuit(m));
+
+  SigMap sigmap(m);
+  std::vector<PackNode> nodes;
+  dict<SigBit, int> driver;
+  dict<SigBit, int> uses;
+
+  for(Cell* cell:m->cells()) {
+    PackNode node;
+    if(node_from_cell(cell, sigmap, k, node)) {
+      driver[node.output]=nodes.size();
+      nodes.push_back(node);
+    }
+    for(auto& conn:cell->connections()) {
+      if(cell->input(conn.first)) {
+	for(const SigBit& b:conn.second) {
+	  uses[sigmap(b)]++;
+	}
+      }
+    }
+  }
+  //Module outputs are never folded away
+  for(Wire* w:m->wires()) {
+    if(w->port_output) {
+      for(int i=0; i<w->width; i++) {
+	uses[sigmap(SigBit(w,i))]+=2;
+      }
+    }
+  }
+
+  int merges=0;
+  bool progress=true;
+  while(progress) {
+    progress=false;
+    for(PackNode& d:nodes) {
+      if(!d.alive) {
+	continue;
+      }
+      for(int i=0; i<GetSize(d.inputs); i++) {
+	SigBit n=d.inputs[i];
+	auto it=driver.find(n);
+	if(it==driver.end() || uses[n]!=1) {
+	  continue;
+	}
+	PackNode& c=nodes[it->second];
+	if(&c==&d || !c.alive || !try_merge(c, d, n, k, uses)) {
+	  continue;
+	}
+	merges++;
+	progress=true;
+	//d has new inputs, start over on them
+	i=-1;
+      }
+    }
+  }
+
+  for(PackNode& node:nodes) {
+    if(!node.alive) {
+      m->remove(node.cell);
+    } else if(node.changed) {
+      IdString name=node.cell->name;
+      m->remove(node.cell);
+      m->addLut(name, SigSpec(node.inputs), node.output, Const(node.truth, 1<<node.inputs.size()));
+    }
+  }
+
+  //The folded nets are left undriven, drop them
+  Pass::call_on_module(m->design, m, "splitnets");
+  Pass::call_on_module(m->design, m, "opt_clean -purge");
+
+  ProofCost after=ProofCost_of(CompiledCircuit(m));
+  log("Packed %d cells into %d-input LUTs\n", merges, k);
+  ProofCost_report("Before packing", before);
+  ProofCost_report("After packing", after);
+}
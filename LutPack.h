@@ -0,0 +1,48 @@
+#ifndef LUT_PACK_H
+#define LUT_PACK_H
+
+#include <kernel/yosys.h>
+
+#include "CompiledCircuit.h"
+
+/* What one proof round of a circuit costs, from its shape alone.  Every
+   table entry is hashed into the commitment, the execution reveal holds
+   one entry per cell and the scrambling reveal every entry; both hold one
+   bit per net.  The verifier opens either reveal with even odds. */
+struct ProofCost {
+  long cells;
+  long nets;
+  long entries;
+  /* Serialized size of one entry of every cell, and of every entry */
+  double cellentrybytes;
+  double entrybytes;
+
+  ProofCost(): cells(0), nets(0), entries(0), cellentrybytes(0), entrybytes(0) {}
+
+  void add_cell(int ninputs, int noutputs);
+  ProofCost& operator+=(const ProofCost& o);
+
+  double commitment_bytes() const;
+  double execution_bytes() const;
+  double scrambling_bytes() const;
+  /* The commitment and the expected reveal */
+  double round_bytes() const;
+
+  long prover_hashes() const { return entries; }
+  double verifier_hashes() const { return (cells+entries)/2.0; }
+};
+
+//ProofCost {
+   ProofCost ProofCost_of(const CompiledCircuit& c);
+   /* Logs the cost per round, with times from a quick measurement of the hash rate */
+   void ProofCost_report(const char* label, const ProofCost& cost);
+//}
+
+/* Merges single fanout cones of single bit gates and LUTs into $lut cells
+   of up to k inputs, wherever the merged cell costs fewer bytes per round
+   than the cells and net it replaces.  The nets this leaves unused are
+   removed.  The result only depends on the module, so both parties get the
+   same circuit from the same source. */
+void LutPack_run(Yosys::Module* m, int k);
+
+#endif //LUT_PACK_H
@@ -3,8 +3,19 @@
 #include <kernel/yosys.h>
 #include <fstream>
 #include <string>
+#include <climits>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <google/protobuf/io/zero_copy_stream_impl.h>
 #include <google/protobuf/io/coded_stream.h>
+#include <crypto++/sha.h>
+
+#include "messages.pb.h"
+#include "Bits.h"
+#include "Stats.h"
+#include "ThreadPool.h"
 
 #define MAGIC_COMMITMENT 0x5a4b50434f4d4954
 #define MAGIC_SECRET     0x5a4b505345435245
@@ -12,32 +23,231 @@
 #define MAGIC_REQUEST    0x5a4b505245515354
 #define MAGIC_REVEAL     0x5a4b50525645414c
 
+/* Format 2 (packed bits) versions of the above */
+#define MAGIC_COMMITMENT_V2 0x5a4b50434f4d5432
+#define MAGIC_SECRET_V2     0x5a4b505345435232
+#define MAGIC_PROVEE_V2     0x5a4b505052564532
+#define MAGIC_REQUEST_V2    0x5a4b505245515332
+#define MAGIC_REVEAL_V2     0x5a4b505256454132
+
+/* Format 3 (chunked rounds) versions, see prover_create -chunked */
+#define MAGIC_COMMITMENT_V3 0x5a4b50434f4d5433
+#define MAGIC_SECRET_V3     0x5a4b505345435233
+#define MAGIC_PROVEE_V3     0x5a4b505052564533
+#define MAGIC_REVEAL_V3     0x5a4b505256454133
+
+/* Secret holding only the seed of each round, see prover_create -s */
+#define MAGIC_SECRET_SEEDED 0x5a4b505345454453
+
+#define MAGIC_TABLE_CACHE   0x5a4b505441424c45
+
+/* Compiled circuit, see compile */
+#define MAGIC_CIRCUIT       0x5a4b50434952434b
+
+/* Non-interactive proof, see prove/verify */
+#define MAGIC_PROOF         0x5a4b5050524f4f46
+
+/* Range validation results and checkpoints, see provee_validate -range */
+#define MAGIC_RESULT        0x5a4b50524553554c
+
+/* Rounds built before the witness is known, see prover_precompute */
+#define MAGIC_POOL          0x5a4b50504f4f4c53
+
+/* Files of unchunked rounds end with an index of their messages: an end
+   marker no reader takes for a message length, the StreamIndex, its length
+   and this magic */
+#define MAGIC_INDEX         0x5a4b50494e444558
+#define INDEX_END_MARKER    0xffffffffffffffffULL
+
+/* The digest the index keeps of each message */
+inline void message_digest(const char* data, size_t size, unsigned char* digest) {
+  CryptoPP::SHA256().CalculateDigest(digest, (const unsigned char*)data, size);
+}
+
+inline bool message_digest_matches(const char* data, size_t size, const unsigned char* digest) {
+  unsigned char d[CryptoPP::SHA256::DIGESTSIZE];
+  message_digest(data, size, d);
+  return memcmp(d, digest, sizeof(d))==0;
+}
+
 USING_YOSYS_NAMESPACE
 
+/* Reads length prefixed messages straight out of an mmap of the whole file,
+   so there is no copy through stream buffers and no limit on the total size.
+   Raw reads return pointers into the mapping, valid as long as the reader. */
 class CodedFileReader {
  private:
-  std::ifstream ifs;
-  google::protobuf::io::IstreamInputStream iis;
+  const char* base;
+  size_t size;
+  size_t pos;
+
+  size_t mapped;
+
+  bool indexed;
+  yosysZKP::StreamIndex index;
+
+  CodedFileReader(const CodedFileReader&);
+  CodedFileReader& operator=(const CodedFileReader&);
+
+  uint64_t load64(size_t at) const {
+    const unsigned char* p=(const unsigned char*)base+at;
+    uint64_t v=0;
+    for(int i=7; i>=0; i--) {
+      v=(v<<8)|p[i];
+    }
+    return v;
+  }
+
+  bool ReadLittleEndian64(uint64_t* v) {
+    if(size-pos<sizeof(*v)) {
+      return false;
+    }
+    *v=load64(pos);
+    pos+=sizeof(*v);
+    return true;
+  }
+
+  /* Hides the index from the message reads, and picks it up if parse is
+     set.  Chunked files are only read in order, so their index, which
+     grows with the blocks of every round, is never parsed. */
+  void read_index(bool parse) {
+    if(size-pos<24 || load64(size-8)!=MAGIC_INDEX) {
+      return;
+    }
+    uint64_t isz=load64(size-16);
+    if(isz>size-pos-24 || load64(size-24-isz)!=INDEX_END_MARKER) {
+      return;
+    }
+    if(!parse) {
+      size-=24+isz;
+      return;
+    }
+    if(isz>INT_MAX || !index.ParseFromArray(base+size-16-isz, isz) ||
+       index.digests().size()!=(size_t)index.offset_size()*CryptoPP::SHA256::DIGESTSIZE) {
+      return;
+    }
+    size_t end=size-24-isz;
+    for(uint64_t o:index.offset()) {
+      if(o>=end) {
+	index.Clear();
+	return;
+      }
+    }
+    size=end;
+    indexed=true;
+  }
  public:
-  google::protobuf::io::CodedInputStream cis;
+  int version;
+
+  /* Accepts the magic of any format given, and records which */
+ CodedFileReader(std::string filename,uint64_t magic,uint64_t magic_v2=0,uint64_t magic_v3=0) : base(nullptr), size(0), pos(0), mapped(0), indexed(false) {
+      int fd=open(filename.c_str(), O_RDONLY);
+      if(fd<0) {
+	log_error("Could not open %s\n", filename.c_str());
+      }
+      struct stat st;
+      if(fstat(fd, &st)==0 && st.st_size>0) {
+	void* p=mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if(p==MAP_FAILED) {
+	  log_error("Could not map %s\n", filename.c_str());
+	}
+	madvise(p, st.st_size, MADV_SEQUENTIAL);
+	base=(const char*)p;
+	size=st.st_size;
+	mapped=size;
+      }
+      close(fd);
 
- CodedFileReader(std::string filename,uint64_t magic) : ifs(filename,std::iostream::binary), iis(&ifs),cis(&iis) {
-      uint64_t m;
-      cis.ReadLittleEndian64(&m);
-      if(m!=magic) {
+      uint64_t m=0;
+      ReadLittleEndian64(&m);
+      stats_add(STAT_BYTES_READ, sizeof(m));
+      if(m==magic) {
+	version=FORMAT_UNPACKED;
+      } else if(magic_v2!=0 && m==magic_v2) {
+	version=FORMAT_PACKED;
+      } else if(magic_v3!=0 && m==magic_v3) {
+	version=FORMAT_CHUNKED;
+      } else {
 	log_error("Bad magic number reading file\n");
       }
+      read_index(version!=FORMAT_CHUNKED);
   }
+
+  /* Files written by older versions have no index */
+  bool has_index() const { return indexed; }
+  size_t indexed_messages() const { return index.offset_size(); }
+  const unsigned char* indexed_digest(size_t k) const {
+    return (const unsigned char*)index.digests().data()+k*CryptoPP::SHA256::DIGESTSIZE;
+  }
+
+  /* Whether the index lists every message of the file in order, each
+     starting where the one before ends and the last ending at the index,
+     so a seek lands where a sequential read would */
+  bool index_is_sequential() const {
+    if(!indexed) {
+      return false;
+    }
+    size_t at=sizeof(uint64_t);
+    for(uint64_t o:index.offset()) {
+      if(o!=at || size-at<sizeof(uint64_t)) {
+	return false;
+      }
+      uint64_t n=load64(at);
+      at+=sizeof(uint64_t);
+      if(n>size-at) {
+	return false;
+      }
+      at+=n;
+    }
+    return at==size;
+  }
+
+  /* Makes message k the next one read */
+  bool Seek(size_t k) {
+    if(!indexed || k>indexed_messages()) {
+      return false;
+    }
+    pos=k<indexed_messages() ? index.offset(k) : size;
+    return true;
+  }
+
+  ~CodedFileReader() {
+    if(base!=nullptr) {
+      munmap((void*)base, mapped);
+    }
+  }
+
   template<typename T>
     bool ReadFromStream(T* t) {
-    uint64_t sz;
-    if(!cis.ReadLittleEndian64(&sz)) {
+    const char* data;
+    size_t sz;
+    if(!ReadRawFromStream(&data, &sz) || sz>INT_MAX) {
+      return false;
+    }
+    return t->ParseFromArray(data, sz);
+  }
+
+  /* The next message without parsing it, so it can be parsed elsewhere */
+  bool ReadRawFromStream(const char** data, size_t* sz) {
+    uint64_t n;
+    if(!ReadLittleEndian64(&n) || n>size-pos) {
+      return false;
+    }
+    *data=base+pos;
+    *sz=n;
+    pos+=n;
+    stats_add(STAT_BYTES_READ, sizeof(n)+n);
+    return true;
+  }
+
+  bool ReadRawFromStream(std::string* buf) {
+    const char* data;
+    size_t sz;
+    if(!ReadRawFromStream(&data, &sz)) {
       return false;
     }
-    google::protobuf::io::CodedInputStream::Limit l=cis.PushLimit(sz);
-    bool res=t->ParseFromCodedStream(&cis);
-    cis.PopLimit(l);
-    return res;
+    buf->assign(data, sz);
+    return true;
   }
   
 };
@@ -46,17 +256,101 @@ class CodedFileWriter {
  private:
   std::ofstream of;
   google::protobuf::io::OstreamOutputStream oos;
- public:
   google::protobuf::io::CodedOutputStream cos;
 
- CodedFileWriter(std::string filename, uint64_t magic) : of(filename,std::iostream::binary), oos(&of), cos(&oos) {
+  uint64_t written;
+  bool indexed;
+  yosysZKP::StreamIndex index;
+  std::string buf;
+
+  CodedFileWriter(const CodedFileWriter&);
+  CodedFileWriter& operator=(const CodedFileWriter&);
+ public:
+
+ /* Only files of rounds something seeks through need an index */
+ CodedFileWriter(std::string filename, uint64_t magic, bool indexed=false) : of(filename,std::iostream::binary), oos(&of), cos(&oos), written(0), indexed(indexed) {
     cos.WriteLittleEndian64(magic);
+    written+=sizeof(magic);
+    stats_add(STAT_BYTES_WRITTEN, sizeof(magic));
+  }
+
+  ~CodedFileWriter() {
+    if(!indexed) {
+      return;
+    }
+    std::string i;
+    index.SerializeToString(&i);
+    cos.WriteLittleEndian64(INDEX_END_MARKER);
+    cos.WriteString(i);
+    cos.WriteLittleEndian64(i.size());
+    cos.WriteLittleEndian64(MAGIC_INDEX);
+    stats_add(STAT_BYTES_WRITTEN, 24+i.size());
   }
 
   template<typename T>
     void WriteToStream(const T* t) {
-    cos.WriteLittleEndian64(t->ByteSize());
-    t->SerializeToCodedStream(&cos);
+    StatTimer timer(STAT_SERIALIZE);
+    t->SerializeToString(&buf);
+    WriteRawToStream(buf);
+  }
+
+  /* Writes an already serialized message */
+  void WriteRawToStream(const std::string& msg) {
+    if(indexed) {
+      unsigned char digest[CryptoPP::SHA256::DIGESTSIZE];
+      message_digest(msg.data(), msg.size(), digest);
+      index.add_offset(written);
+      index.mutable_digests()->append((const char*)digest, sizeof(digest));
+    }
+
+    cos.WriteLittleEndian64(msg.size());
+    cos.WriteString(msg);
+    written+=sizeof(uint64_t)+msg.size();
+    stats_add(STAT_BYTES_WRITTEN, sizeof(uint64_t)+msg.size());
+  }
+};
+
+/* A CodedFileWriter on a thread of its own, fed through a bounded queue of
+   serialized messages.  The caller only blocks once the disk falls depth
+   messages behind; the file is complete when the writer is destroyed. */
+class AsyncFileWriter {
+ private:
+  CodedFileWriter out;
+  BoundedQueue<std::string> queue;
+  std::thread thread;
+
+  AsyncFileWriter(const AsyncFileWriter&);
+  AsyncFileWriter& operator=(const AsyncFileWriter&);
+
+  void drain() {
+    std::string msg;
+    while(queue.pop(msg)) {
+      out.WriteRawToStream(msg);
+    }
+  }
+
+ public:
+  AsyncFileWriter(std::string filename, uint64_t magic, bool indexed=false, size_t depth=16) : out(filename, magic, indexed), queue(depth) {
+    thread=std::thread(&AsyncFileWriter::drain, this);
+  }
+
+  ~AsyncFileWriter() {
+    queue.close();
+    thread.join();
+  }
+
+  template<typename T>
+  void WriteToStream(const T* t) {
+    std::string msg;
+    {
+      StatTimer timer(STAT_SERIALIZE);
+      t->SerializeToString(&msg);
+    }
+    queue.push(std::move(msg));
+  }
+
+  void WriteRawToStream(std::string msg) {
+    queue.push(std::move(msg));
   }
 };
 #endif
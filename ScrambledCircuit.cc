@@ -1,231 +1,645 @@
 #include "ScrambledCircuit.h"
 #include "TruthTable.h"
+#include "TableCache.h"
+#include "Stats.h"
 
 #include <kernel/consteval.h>
 #include <kernel/celltypes.h>
 
+#include <crypto++/sha.h>
+
+#include <map>
+
 USING_YOSYS_NAMESPACE
 using namespace CryptoPP;
 
 
-ScrambledCircuit::ScrambledCircuit(Module* module): rand(true), m(module), execution(m), keys(m) {
-  m->sort();
+BitView Commitment_outputs(const yosysZKP::Commitment& commitment, int noutputs) {
+  if(commitment.has_packed_output()) {
+    if(commitment.output_size()!=0) {
+      return BitView();
+    }
+    return BitView(commitment.packed_output(), noutputs);
+  }
+  return BitView(commitment.output());
+}
+
+ProofRound::ProofRound(const CompiledCircuit& c): keys(c, true) {
+
+}
+
+ScrambledCircuit::ScrambledCircuit(Module* module): m(module), c(module), eval(c), execution(c), round(c), format(FORMAT_PACKED), freexor(false) {
   enumerate_wires();
   initialize_cell_tables();
+  eval.compile(canonical);
+  if(!eval.supported) {
+    log("Circuit has cells the bit-sliced evaluator does not handle, falling back to ConstEval\n");
+  }
+  find_linear_cells();
+}
+
+ScrambledCircuit::ScrambledCircuit(const yosysZKP::CircuitFile& file): m(nullptr), c(file), eval(c), execution(c), round(c), format(FORMAT_PACKED), freexor(false) {
+  load_cell_tables(file);
+  eval.compile(canonical);
+  find_linear_cells();
+}
+
+yosysZKP::CircuitFile ScrambledCircuit::serialize() const {
+  yosysZKP::CircuitFile result;
+  result.set_nbits(c.nbits);
+  for(int b:c.inputs) {
+    result.add_inputs(b);
+  }
+  for(int b:c.outputs) {
+    result.add_outputs(b);
+  }
+
+  //The TableCache hands out one table per distinct gate
+  std::map<const yosysZKP::TruthTable*, int> tableindex;
+  for(size_t i=0; i<c.cells.size(); i++) {
+    const CompiledCell& cell=c.cells[i];
+    if(!tableindex.count(gatesdef[i])) {
+      tableindex[gatesdef[i]]=result.tables_size();
+      yosysZKP::CircuitTable* t=result.add_tables();
+      t->set_type(cell.type.str());
+      *t->mutable_table()=*gatesdef[i];
+    }
+    result.add_cell_name(cell.name.str());
+    result.add_cell_table(tableindex.at(gatesdef[i]));
+    result.add_cell_ninputs(cell.ninputs);
+    result.add_cell_noutputs(cell.noutputs);
+    for(int k=0; k<cell.ninputs+cell.noutputs; k++) {
+      result.add_portbits(c.portbits[cell.inputs+k]);
+    }
+  }
+  return result;
+}
+
+yosysZKP::Commitment ScrambledCircuit::create_proof_round(unsigned char* seedout) {
+  keystream.Reseed(seedout);
+  return create_proof_round(round, keystream);
+}
+
+yosysZKP::ExecutionReveal ScrambledCircuit::reveal_execution() {
+  return reveal_execution(round);
+}
+
+yosysZKP::ScramblingReveal ScrambledCircuit::reveal_scrambling() {
+  return reveal_scrambling(round);
 }
 
-yosysZKP::Commitment ScrambledCircuit::create_proof_round() {
+yosysZKP::Commitment ScrambledCircuit::create_proof_round(ProofRound& r, RandomNumberGenerator& rng) const {
+  yosysZKP::Commitment result=commit_round(r, rng);
+  commit_outputs(result);
+  return result;
+}
+
+yosysZKP::Commitment ScrambledCircuit::commit_round(ProofRound& r, RandomNumberGenerator& rng) const {
   yosysZKP::Commitment result;
 
-  for(auto& it:execution.map) {
-    keys.map[it.first]=rand.GenerateBit();
+  scramble_round(r, rng);
+  stats_add(STAT_ROUNDS);
+
+  {
+    StatTimer timer(STAT_COMMIT);
+    std::vector<const yosysZKP::TruthTable*> tables;
+    for(const yosysZKP::TruthTable& g:r.gates) {
+      tables.push_back(&g);
+    }
+    TruthTable_get_commitments(tables, result.mutable_gatehashes());
   }
 
-  for(Cell* cell:m->cells()) {
-    std::vector<bool> inputkey;
-    std::vector<bool> outputkey;
-    get_gate_ports(keys, cell, inputkey, outputkey);
-    
-    gates[cell->name]=gatesdef[cell->name];
-    TruthTable_scramble(gates[cell->name], rand, inputkey, outputkey);
-    *result.add_gatehashes()=TruthTable_get_commitment(gates[cell->name]);
+  if(freexor) {
+    result.set_free_xor(true);
+  }
+  return result;
+}
+
+void ScrambledCircuit::commit_outputs(yosysZKP::Commitment& commitment) const {
+  if(format==FORMAT_PACKED) {
+    std::vector<bool> outputs;
+    for(int o:c.outputs) {
+      outputs.push_back(execution.bits[o]);
+    }
+    pack_bits(outputs, commitment.mutable_packed_output());
+  } else {
+    for(int o:c.outputs) {
+      commitment.add_output(execution.bits[o]);
+    }
+  }
+}
+
+bool ScrambledCircuit::load_round(const yosysZKP::ScramblingReveal& reveal, ProofRound& r) const {
+  if(!r.keys.deserialize(reveal.keys()) || reveal.gates_size()!=(int)c.cells.size()) {
+    return false;
+  }
+  r.gates.assign(reveal.gates().begin(), reveal.gates().end());
+  return true;
+}
+
+void ScrambledCircuit::scramble_round(ProofRound& r, RandomNumberGenerator& rng) const {
+  StatTimer timer(STAT_SCRAMBLE);
+  scramble_keys(r.keys, rng);
+
+  r.gates.resize(c.cells.size());
+  std::vector<bool> inputkey;
+  std::vector<bool> outputkey;
+  for(size_t i=0; i<c.cells.size(); i++) {
+    scramble_cell(r.keys, i, rng, r.gates[i], inputkey, outputkey);
+  }
+}
+
+void ScrambledCircuit::scramble_keys(WireValues& keys, RandomNumberGenerator& rng) const {
+  for(int i=0; i<c.nbits; i++) {
+    keys.bits[i]=rng.GenerateBit();
+  }
+  //Outputs are revealed, so they must be unscrambled before the tables are built
+  for(int o:c.outputs) {
+    keys.bits[o]=0;
+  }
+  if(freexor) {
+    for(int i:linearorder) {
+      const CompiledCell& cell=c.cells[i];
+      bool key=false;
+      for(int k=0; k<cell.ninputs; k++) {
+	if((linear[i].mask>>k)&1) {
+	  key^=keys.bits[c.portbits[cell.inputs+k]];
+	}
+      }
+      keys.bits[c.portbits[cell.outputs]]=key;
+    }
   }
+}
+
+void ScrambledCircuit::scramble_cell(const WireValues& keys, int n, RandomNumberGenerator& rng, yosysZKP::TruthTable& table, std::vector<bool>& inputkey, std::vector<bool>& outputkey) const {
+  if(is_free(n, freexor)) {
+    table.Clear();
+    return;
+  }
+  get_gate_ports(keys, c.cells[n], inputkey, outputkey);
 
-  for(const SigBit& s: alloutputs) {
-    bool b;
-    if(s.wire!=nullptr) {
-      keys.map[s.wire->name]=0;
-      b=execution.map[s.wire->name];
-    } else {
-      b=(s.data==State::S1);
+  table=*gatesdef[n];
+  TruthTable_scramble(table, rng, inputkey, outputkey);
+  if(format==FORMAT_PACKED) {
+    for(yosysZKP::TruthTableEntry& e:*table.mutable_entries()) {
+      TruthTableEntry_pack(e);
     }
-    result.add_output(b);
   }
+}
 
+int ScrambledCircuit::round_blocks() const {
+  return (c.cells.size()+ROUND_BLOCK_CELLS-1)/ROUND_BLOCK_CELLS;
+}
+
+void ScrambledCircuit::scramble_block(const WireValues& keys, const std::string& seed, int block, RoundBlock& b) const {
+  StatTimer timer(STAT_SCRAMBLE);
+  KeystreamRNG rng;
+  rng.SeedFrom(seed, block);
+
+  b.begin=block*ROUND_BLOCK_CELLS;
+  b.end=std::min<int>(c.cells.size(), b.begin+ROUND_BLOCK_CELLS);
+  b.gates.resize(b.end-b.begin);
+  std::vector<bool> inputkey;
+  std::vector<bool> outputkey;
+  for(int n=b.begin; n<b.end; n++) {
+    scramble_cell(keys, n, rng, b.gates[n-b.begin], inputkey, outputkey);
+  }
+}
+
+yosysZKP::Commitment ScrambledCircuit::commit_chunked() const {
+  yosysZKP::Commitment result;
+  stats_add(STAT_ROUNDS);
+  if(freexor) {
+    result.set_free_xor(true);
+  }
+  commit_outputs(result);
+  result.set_blocks(round_blocks());
+  return result;
+}
+
+yosysZKP::Commitment ScrambledCircuit::commit_block(const RoundBlock& b) const {
+  StatTimer timer(STAT_COMMIT);
+  yosysZKP::Commitment result;
+  std::vector<const yosysZKP::TruthTable*> tables;
+  for(const yosysZKP::TruthTable& g:b.gates) {
+    tables.push_back(&g);
+  }
+  TruthTable_get_commitments(tables, result.mutable_gatehashes());
+  return result;
+}
+
+void ScrambledCircuit::hash_circuit(SHA256& sha) const {
+  std::string buf;
+  for(size_t i=0; i<c.cells.size(); i++) {
+    const CompiledCell& cell=c.cells[i];
+    sha.Update((const byte*)cell.type.c_str(), strlen(cell.type.c_str())+1);
+    sha.Update((const byte*)&c.portbits[cell.inputs], cell.ninputs*sizeof(int));
+    sha.Update((const byte*)&c.portbits[cell.outputs], cell.noutputs*sizeof(int));
+    gatesdef[i]->SerializeToString(&buf);
+    sha.Update((const byte*)buf.data(), buf.size());
+  }
+  sha.Update((const byte*)c.inputs.data(), c.inputs.size()*sizeof(int));
+  sha.Update((const byte*)c.outputs.data(), c.outputs.size()*sizeof(int));
+}
+
+std::string ScrambledCircuit::circuit_fingerprint() const {
+  SHA256 sha;
+  hash_circuit(sha);
+
+  std::string result(SHA256::DIGESTSIZE, 0);
+  sha.Final((byte*)&result[0]);
+  return result;
+}
+
+std::string ScrambledCircuit::fingerprint() const {
+  SHA256 sha;
+  hash_circuit(sha);
+  std::string buf;
+  pack_bits(execution.bits, &buf);
+  sha.Update((const byte*)buf.data(), buf.size());
+
+  std::string result(SHA256::DIGESTSIZE, 0);
+  sha.Final((byte*)&result[0]);
   return result;
 }
 
 Const ScrambledCircuit::execute(Const inputs) {
-  ConstEval ce(m);
-  ce.push();
-  ce.set(allinputs, inputs);
-  {
+  StatTimer timer(STAT_EXECUTE);
+  if(eval.supported) {
+    eval.execute(inputs, execution);
+  } else if(m==nullptr) {
+    log_error("Compiled circuit has cells the bit-sliced evaluator does not handle, execute it from the source file\n");
+  } else {
+    ConstEval ce(m);
+    ce.push();
+    ce.set(allinputs, inputs);
     SigSpec sig_wires=allwires, sig_undef;
     if(!ce.eval(sig_wires, sig_undef)) {
       log_error("Eval failed for execute: Missing value for %s\n", log_signal(sig_undef));
     }
-    execution.map.clear();
-    keys.map.clear();
     for(int i=0; i<allwires.size(); i++) {
-      Wire* w=allwires[i].wire;
-      execution.map[w->name]=(sig_wires[i]==State::S1);
-      keys.map[w->name]=0;
+      int idx=c.bit_index(allwires[i]);
+      if(idx<c.nbits) {
+	execution.bits[idx]=(sig_wires[i]==State::S1);
+      }
     }
-    execution.map.sort(RTLIL::sort_by_id_str());
-    keys.map.sort(RTLIL::sort_by_id_str());
+    ce.pop();
   }
+
   Const result;
-  {
-    SigSpec sig_out=alloutputs, sig_undef;
-    if(!ce.eval(sig_out, sig_undef)) {
-      log_error("Eval failed for execute: Missing value for %s\n", log_signal(sig_undef));
-    }
+  for(int o:c.outputs) {
+    result.bits.push_back(execution.bits[o] ? State::S1 : State::S0);
+  }
+  return result;
+}
 
-    result=sig_out.as_const();
+std::vector<Const> ScrambledCircuit::execute_batch(const std::vector<Const>& inputs, std::vector<WireValues>& executions) {
+  if(eval.supported) {
+    StatTimer timer(STAT_EXECUTE);
+    return eval.execute_batch(inputs, &executions);
   }
-  ce.pop();
 
+  std::vector<Const> result;
+  executions.clear();
+  for(const Const& in:inputs) {
+    result.push_back(execute(in));
+    executions.push_back(execution);
+  }
   return result;
 }
 
-yosysZKP::ExecutionReveal ScrambledCircuit::reveal_execution() {
-  yosysZKP::ExecutionReveal exec;
-  yosysZKP::WireValues* wv=exec.mutable_exec();
-  for(const auto& it:execution.map) {
-    bool bit=it.second ^keys.map[it.first];
-    wv->add_entries(bit);
+WireValues ScrambledCircuit::masked_execution(const WireValues& keys) const {
+  WireValues masked(c);
+  for(int i=0; i<c.nbits; i++) {
+    masked.bits[i]=execution.bits[i]^keys.bits[i];
   }
+  return masked;
+}
 
-  for(Cell* cell: m->cells()) {
-    const yosysZKP::TruthTable& g=gates[cell->name];
-
-    std::vector<bool> inputval,  inputkey;
-    std::vector<bool> outputval, outputkey; 
+void ScrambledCircuit::add_execution_entry(const WireValues& masked, int n, const yosysZKP::TruthTable& g, yosysZKP::ExecutionReveal& exec, std::vector<bool>& inputval, std::vector<bool>& outputval) const {
+  const CompiledCell& cell=c.cells[n];
 
-    get_gate_ports(execution, cell, inputval, outputval);
-    get_gate_ports(keys, cell, inputkey, outputkey);
+  get_gate_ports(masked, cell, inputval, outputval);
 
-    int count=0;
-    for(const yosysZKP::TruthTableEntry& e: g.entries()) {
+  int count=0;
+  for(const yosysZKP::TruthTableEntry& e: g.entries()) {
+    BitView ein=TruthTableEntry_inputs(e, inputval.size());
+    BitView eout=TruthTableEntry_outputs(e, inputval.size(), outputval.size());
       
-      for(size_t i=0; i<inputval.size(); i++)
-	if(e.inputs(i) !=(inputval[i]^inputkey[i])) 
-	  goto loop_continue;
+    for(size_t i=0; i<inputval.size(); i++)
+      if(ein[i] !=inputval[i]) 
+	goto loop_continue;
 
-      for(size_t i=0; i<outputval.size(); i++)
-	if(e.outputs(i) != (outputval[i]^outputkey[i]))
-	  log_error("Error, truth table does not match computed execution for cell %s %s\n",log_id(cell->type), log_id(cell->name));
+    for(size_t i=0; i<outputval.size(); i++)
+      if(eout[i] != outputval[i])
+	log_error("Error, truth table does not match computed execution for cell %s %s\n",log_id(cell.type), log_id(cell.name));
 
-      *exec.add_entries()=e;
-      count++;
-    loop_continue: ;
-    }
-    if(count!=1) {
-      log_error("Truth table contains multiple entries for the same inputs\n");
+    *exec.add_entries()=e;
+    count++;
+  loop_continue: ;
+  }
+  if(count!=1) {
+    log_error("Truth table contains multiple entries for the same inputs\n");
+  }
+}
+
+yosysZKP::ExecutionReveal ScrambledCircuit::reveal_execution(const ProofRound& r) const {
+  StatTimer timer(STAT_REVEAL);
+  yosysZKP::ExecutionReveal exec;
+
+  WireValues scrambledexec=masked_execution(r.keys);
+  *exec.mutable_exec()=scrambledexec.serialize(format);
+
+  std::vector<bool> inputval, outputval;
+  for(size_t n=0; n<c.cells.size(); n++) {
+    if(!is_free(n, freexor)) {
+      add_execution_entry(scrambledexec, n, r.gates[n], exec, inputval, outputval);
     }
   }
   return exec;
 }
 
-yosysZKP::ScramblingReveal ScrambledCircuit::reveal_scrambling() {
+yosysZKP::ScramblingReveal ScrambledCircuit::reveal_scrambling(const ProofRound& r) const {
+  StatTimer timer(STAT_REVEAL);
   yosysZKP::ScramblingReveal scr;
-  *scr.mutable_keys()=keys.serialize();
-  for(Cell* cell:m->cells()) {
-    *scr.add_gates()=gates[cell->name];
+  *scr.mutable_keys()=r.keys.serialize(format);
+  for(const yosysZKP::TruthTable& g:r.gates) {
+    *scr.add_gates()=g;
   }
  
   return scr;
 }
 
+void ScrambledCircuit::reveal_execution_block(const WireValues& masked, const RoundBlock& b, yosysZKP::ExecutionReveal& reveal) const {
+  StatTimer timer(STAT_REVEAL);
+  std::vector<bool> inputval, outputval;
+  for(int n=b.begin; n<b.end; n++) {
+    if(!is_free(n, freexor)) {
+      add_execution_entry(masked, n, b.gates[n-b.begin], reveal, inputval, outputval);
+    }
+  }
+}
+
+void ScrambledCircuit::reveal_scrambling_block(const RoundBlock& b, yosysZKP::ScramblingReveal& reveal) const {
+  StatTimer timer(STAT_REVEAL);
+  for(const yosysZKP::TruthTable& g:b.gates) {
+    *reveal.add_gates()=g;
+  }
+}
+
 
 
 bool ScrambledCircuit::validate_precommitment(const yosysZKP::Commitment& commitment, const yosysZKP::ExecutionReveal& reveal) {
+  WireValues scrambledexec(c);
+  CommitmentIndex index;
+  std::string error=check_round(commitment, reveal, scrambledexec, index);
+  if(error.empty()) {
+    error=check_cells(commitment, index, reveal, scrambledexec, 0, c.cells.size());
+  }
+  if(!error.empty()) {
+    log_error("%s\n", error.c_str());
+    return false;
+  }
+  return true;
+}
 
-  //Validate that we are revealing a precommitted entry
-  for(int i=0; i<commitment.gatehashes_size(); i++) {
-    const yosysZKP::TableCommitment& com=commitment.gatehashes(i);
-    std::string entryhash=TruthTableEntry_get_commitment(reveal.entries(i));
+bool ScrambledCircuit::validate_precommitment(const yosysZKP::Commitment& commitment, const yosysZKP::ScramblingReveal& reveal) {
+  WireValues keys(c, true);
+  std::string error=check_round(commitment, reveal, keys);
+  if(error.empty()) {
+    error=check_cells(commitment, reveal, keys, 0, c.cells.size());
+  }
+  if(!error.empty()) {
+    log_error("%s\n", error.c_str());
+    return false;
+  }
+  return true;
+}
 
-    bool found=false;
-    for(int j=0; j<com.entryhashes_size(); j++) {
-      if(com.entryhashes(j) == entryhash) {
-	found=true;
-      }
-    }
-    if(!found) {
-      log_error("Found unmatched table entry hash\n");
-      return false;
-    }
+std::string ScrambledCircuit::check_round(const yosysZKP::Commitment& commitment, const yosysZKP::ExecutionReveal& reveal, WireValues& scrambledexec, CommitmentIndex& index) const {
+  StatTimer timer(STAT_VALIDATE);
+  stats_add(STAT_ROUNDS);
+  int nentries=commitment.free_xor() ? c.cells.size()-linearorder.size() : c.cells.size();
+  if(commitment.gatehashes_size()!=(int)c.cells.size() || reveal.entries_size()!=nentries) {
+    return "Number of gates does not match circuit";
+  }
+  BitView committed=Commitment_outputs(commitment, c.outputs.size());
+  if(committed.size()!=(int)c.outputs.size()) {
+    return "Number of outputs does not match circuit";
+  }
+
+  if(!scrambledexec.deserialize(reveal.exec())) {
+    return "Wrong number of wire values in execution";
   }
   
-  //Validate that the execution trace matches the revealed gates
-  WireValues scrambledexec(m);
-  scrambledexec.deserialize(reveal.exec());
-  
-  for(int i=0; i<alloutputs.size(); i++) {
-    const SigBit& s=alloutputs[i];
-    bool b;
-    if(s.wire!=nullptr) {
-      b=scrambledexec.map[s.wire->name];
-    } else {
-      b=s.data;
+  for(size_t i=0; i<c.outputs.size(); i++) {
+    if(scrambledexec.bits[c.outputs[i]]!=committed[i]) {
+      return "Output does not match commitment";
     }
-    if(b!=commitment.output(i)) {
-      log_error("Output does not match commitment\n");      
-      return false;
+  }
+
+  if(!index.build(commitment)) {
+    return "Malformed entry hash in commitment";
+  }
+  return "";
+}
+
+std::string ScrambledCircuit::check_cells(const yosysZKP::Commitment& commitment, const CommitmentIndex& index, const yosysZKP::ExecutionReveal& reveal, const WireValues& scrambledexec, int begin, int end, const std::atomic<bool>* abort) const {
+  return check_entries(commitment.free_xor(), index, reveal, scrambledexec, begin, end, 0, abort);
+}
+
+/* Hash check and consistency check in one pass over the gates */
+std::string ScrambledCircuit::check_entries(bool free, const CommitmentIndex& index, const yosysZKP::ExecutionReveal& reveal, const WireValues& scrambledexec, int begin, int end, int base, const std::atomic<bool>* abort) const {
+  StatTimer timer(STAT_VALIDATE);
+  std::vector<const yosysZKP::TruthTableEntry*> entries;
+  for(int i=begin; i<end; i++) {
+    if(!is_free(i, free)) {
+      entries.push_back(&reveal.entries(free ? entryindex[i]-entryindex[base] : i-base));
     }
   }
+  std::vector<unsigned char> entryhashes(entries.size()*SHA256::DIGESTSIZE);
+  TruthTableEntry_get_commitments(entries, entryhashes.data());
+
+  std::vector<bool> inputs, outputs;
+  int e=0;
+  for(int i=begin; i<end; i++) {
+    if(abort!=nullptr && abort->load(std::memory_order_relaxed)) {
+      return "";
+    }
+    if(is_free(i, free)) {
+      if(!check_linear(scrambledexec, i, linear[i].invert)) {
+	return "Masked values do not XOR up for cell "+RTLIL::unescape_id(c.cells[i].name);
+      }
+      continue;
+    }
+    const yosysZKP::TruthTableEntry& entry=*entries[e];
 
-    
-  int i=0;
-  for(Cell* cell: m->cells()) {
-    const yosysZKP::TruthTableEntry& entry=reveal.entries(i);
-    std::vector<bool> inputs, outputs;
-    get_gate_ports(scrambledexec, cell, inputs, outputs);
+    //Validate that we are revealing a precommitted entry
+    if(!index.contains(i-base, &entryhashes[e*SHA256::DIGESTSIZE])) {
+      return "Found unmatched table entry hash";
+    }
+    e++;
 
-    if(inputs.size()!=(unsigned)entry.inputs_size() || outputs.size()!=(unsigned)entry.outputs_size()) {
-      log_error("Size mismatch in truth table entry\n");
+    //Validate that the execution trace matches the revealed gate
+    get_gate_ports(scrambledexec, c.cells[i], inputs, outputs);
+
+    if(!TruthTableEntry_has_shape(entry, inputs.size(), outputs.size())) {
+      return "Size mismatch in truth table entry";
     }
     
     if(!TruthTableEntry_verify_computation(entry, inputs, outputs)) {
-      log_error("Failed to find corresponding truth table entry for cell %s\n",log_id(cell->name));
-      return false;
+      return "Failed to find corresponding truth table entry for cell "+RTLIL::unescape_id(c.cells[i].name);
     }
-    i++;
   }
+  return "";
+}
 
-  return true;
+std::string ScrambledCircuit::check_round(const yosysZKP::Commitment& commitment, const yosysZKP::ScramblingReveal& reveal, WireValues& keys) const {
+  StatTimer timer(STAT_VALIDATE);
+  stats_add(STAT_ROUNDS);
+  if(commitment.gatehashes_size()!=(int)c.cells.size() || reveal.gates_size()!=(int)c.cells.size()) {
+    return "Number of gates does not match circuit";
+  }
+
+  if(!keys.deserialize(reveal.keys())) {
+    return "Wrong number of wire keys in scrambling";
+  }
+  
+  for(int o:c.outputs) {
+    if(keys.bits[o]!=0) {
+      return "Output key was not empty";
+    }
+  }
+  return "";
 }
-bool ScrambledCircuit::validate_precommitment(const yosysZKP::Commitment& commitment, const yosysZKP::ScramblingReveal& reveal) {
-  for(int i=0; i<commitment.gatehashes_size(); i++) {
-    const yosysZKP::TableCommitment& com=commitment.gatehashes(i);
-    const yosysZKP::TableCommitment& hash=TruthTable_get_commitment(reveal.gates(i));
+
+std::string ScrambledCircuit::check_cells(const yosysZKP::Commitment& commitment, const yosysZKP::ScramblingReveal& reveal, const WireValues& keys, int begin, int end, const std::atomic<bool>* abort) const {
+  return check_tables(commitment.free_xor(), commitment, reveal, keys, begin, end, 0, abort);
+}
+
+std::string ScrambledCircuit::check_tables(bool free, const yosysZKP::Commitment& commitment, const yosysZKP::ScramblingReveal& reveal, const WireValues& keys, int begin, int end, int base, const std::atomic<bool>* abort) const {
+  StatTimer timer(STAT_VALIDATE);
+  std::vector<const yosysZKP::TruthTable*> tables;
+  for(int i=begin; i<end; i++) {
+    tables.push_back(&reveal.gates(i-base));
+  }
+  google::protobuf::RepeatedPtrField<yosysZKP::TableCommitment> hashes;
+  TruthTable_get_commitments(tables, &hashes);
+
+  std::vector<bool> inputkeys, outputkeys;
+  std::vector<uint64_t> inputword, outputwords;
+  for(int i=begin; i<end; i++) {
+    if(abort!=nullptr && abort->load(std::memory_order_relaxed)) {
+      return "";
+    }
+    const yosysZKP::TruthTable& table=reveal.gates(i-base);
+
+    const yosysZKP::TableCommitment& com=commitment.gatehashes(i-base);
+    if(is_free(i, free)) {
+      //The key relation stands in for the table
+      if(com.entryhashes_size()!=0 || table.entries_size()!=0) {
+	return "Free XOR cell has a table";
+      }
+      if(!check_linear(keys, i, false)) {
+	return "Keys do not XOR up for cell "+RTLIL::unescape_id(c.cells[i].name);
+      }
+      continue;
+    }
+    const yosysZKP::TableCommitment& hash=hashes.Get(i-begin);
+    if(com.entryhashes_size()!=hash.entryhashes_size()) {
+      return "Hash check failed for truth table";
+    }
     for(int j=0; j<com.entryhashes_size(); j++) {
       if(com.entryhashes(j) !=hash.entryhashes(j)) {
-	log_error("Hash check failed for truth table\n");
-	return false;
+	return "Hash check failed for truth table";
+      }
+    }
+
+    const CanonicalTable& ct=*canonical[i];
+    get_gate_ports(keys, c.cells[i], inputkeys, outputkeys);
+    pack_words(inputkeys, inputword);
+    pack_words(outputkeys, outputwords);
+    uint64_t inputkey=inputword.empty() ? 0 : inputword[0];
+    for(const yosysZKP::TruthTableEntry& entry: table.entries()) {
+      if(!TruthTableEntry_has_shape(entry, ct.ninputs, ct.noutputs) ||
+	 !CanonicalTable_contains_entry(ct, entry, inputkey, outputwords.data())) {
+	return "Failed to find match truth tables for cell "+RTLIL::unescape_id(c.cells[i].name);
       }
     }
   }
+  return "";
+}
 
-  keys.deserialize(reveal.keys());
-  
-  for(const SigBit& b:alloutputs) {
-    if(b.wire!=nullptr && keys.map[b.wire->name]!=0) {
-      log_error("Output key was not empty\n");
-      return false;
+std::string ScrambledCircuit::check_header(const yosysZKP::Commitment& header, const yosysZKP::ExecutionReveal& reveal, WireValues& scrambledexec) const {
+  StatTimer timer(STAT_VALIDATE);
+  stats_add(STAT_ROUNDS);
+  if(header.blocks()!=round_blocks() || header.gatehashes_size()!=0 || reveal.entries_size()!=0) {
+    return "Number of blocks does not match circuit";
+  }
+  BitView committed=Commitment_outputs(header, c.outputs.size());
+  if(committed.size()!=(int)c.outputs.size()) {
+    return "Number of outputs does not match circuit";
+  }
+
+  if(!scrambledexec.deserialize(reveal.exec())) {
+    return "Wrong number of wire values in execution";
+  }
+
+  for(size_t i=0; i<c.outputs.size(); i++) {
+    if(scrambledexec.bits[c.outputs[i]]!=committed[i]) {
+      return "Output does not match commitment";
     }
   }
-  
-  int i=0;
-  for(Cell* cell: m->cells()) {
-    const yosysZKP::TruthTable& table=reveal.gates(i);
-    const yosysZKP::TruthTable& canonical=gatesdef[cell->name];
-    
-    std::vector<bool> inputkeys, outputkeys;
-    get_gate_ports(keys, cell, inputkeys, outputkeys);
-    for(const yosysZKP::TruthTableEntry& entry: table.entries()) {
-      if(!TruthTable_contains_entry(canonical, entry, inputkeys, outputkeys)) {
-	log_error("Failed to find match truth tables for cell %s\n",log_id(cell->name));
-	return false;
-      }
+  return "";
+}
+
+std::string ScrambledCircuit::check_block(const yosysZKP::Commitment& header, const yosysZKP::Commitment& block, const yosysZKP::ExecutionReveal& reveal, const WireValues& scrambledexec, int b) const {
+  int begin=b*ROUND_BLOCK_CELLS;
+  int end=std::min<int>(c.cells.size(), begin+ROUND_BLOCK_CELLS);
+  bool free=header.free_xor();
+  int nentries=0;
+  for(int i=begin; i<end; i++) {
+    nentries+=!is_free(i, free);
+  }
+  if(block.gatehashes_size()!=end-begin || reveal.entries_size()!=nentries || reveal.has_exec()) {
+    return "Number of gates does not match circuit";
+  }
+
+  CommitmentIndex index;
+  if(!index.build(block)) {
+    return "Malformed entry hash in commitment";
+  }
+  return check_entries(free, index, reveal, scrambledexec, begin, end, begin, nullptr);
+}
+
+std::string ScrambledCircuit::check_header(const yosysZKP::Commitment& header, const yosysZKP::ScramblingReveal& reveal, WireValues& keys) const {
+  StatTimer timer(STAT_VALIDATE);
+  stats_add(STAT_ROUNDS);
+  if(header.blocks()!=round_blocks() || header.gatehashes_size()!=0 || reveal.gates_size()!=0) {
+    return "Number of blocks does not match circuit";
+  }
+
+  if(!keys.deserialize(reveal.keys())) {
+    return "Wrong number of wire keys in scrambling";
+  }
+
+  for(int o:c.outputs) {
+    if(keys.bits[o]!=0) {
+      return "Output key was not empty";
     }
-    i++;
   }
-  return true;
+  return "";
+}
+
+std::string ScrambledCircuit::check_block(const yosysZKP::Commitment& header, const yosysZKP::Commitment& block, const yosysZKP::ScramblingReveal& reveal, const WireValues& keys, int b) const {
+  int begin=b*ROUND_BLOCK_CELLS;
+  int end=std::min<int>(c.cells.size(), begin+ROUND_BLOCK_CELLS);
+  if(block.gatehashes_size()!=end-begin || reveal.gates_size()!=end-begin || reveal.has_keys()) {
+    return "Number of gates does not match circuit";
+  }
+  return check_tables(header.free_xor(), block, reveal, keys, begin, end, begin, nullptr);
 }
 
-  
 void ScrambledCircuit::enumerate_wires() {
   {
     pool<Wire*> wires;
@@ -245,31 +659,149 @@ void ScrambledCircuit::enumerate_wires() {
 }
 
 void ScrambledCircuit::initialize_cell_tables() {
-  for(Cell* c:m->cells()) {
-    gatesdef[c->name]=TruthTable_from_gate(c);
+  StatTimer timer(STAT_CELL_TABLES);
+  gatesdef.clear();
+  canonical.clear();
+  for(const CompiledCell& cell:c.cells) {
+    const CachedGate& g=TableCache_get(cell.cell);
+    gatesdef.push_back(&g.table);
+    canonical.push_back(&g.canonical);
+  }
+}
+
+void ScrambledCircuit::load_cell_tables(const yosysZKP::CircuitFile& file) {
+  StatTimer timer(STAT_CELL_TABLES);
+  //The canonical forms are rebuilt rather than stored, so everything that
+  //validation relies on is covered by the circuit hash
+  tables.resize(file.tables_size());
+  for(int i=0; i<file.tables_size(); i++) {
+    tables[i].table=file.tables(i).table();
+    tables[i].canonical=CanonicalTable_from_table(tables[i].table);
+  }
+  gatesdef.clear();
+  canonical.clear();
+  for(int i=0; i<file.cell_table_size(); i++) {
+    const CachedGate& g=tables[file.cell_table(i)];
+    if(c.cells[i].ninputs!=g.canonical.ninputs || c.cells[i].noutputs!=g.canonical.noutputs) {
+      log_error("Compiled circuit is damaged\n");
+    }
+    gatesdef.push_back(&g.table);
+    canonical.push_back(&g.canonical);
   }
 }
 
+void ScrambledCircuit::find_linear_cells() {
+  linear.assign(c.cells.size(), LinearCell());
+  linearorder.clear();
+  entryindex.assign(c.cells.size(), 0);
 
-void ScrambledCircuit::get_gate_ports(WireValues& values, const Cell* cell, std::vector<bool>& inputs, std::vector<bool>& outputs, bool zeroconst) {
-  inputs.clear();
-  outputs.clear();
-  for(auto& it:cell->connections()) {
-    bool input=cell->input(it.first);
+  std::vector<bool> fixed(c.nbits+2, false);
+  for(int o:c.outputs) {
+    fixed[o]=true;
+  }
+  for(int i:c.inputs) {
+    fixed[i]=true;
+  }
 
-    for(const SigBit& b:it.second) {
-      char bit=zeroconst?0:b.data;
-      if(b.wire!=nullptr){
-	bit=values.map[b.wire->name];
+  //Affine single output tables: the output for each single input set tells
+  //which inputs take part, the rest of the table must agree
+  std::vector<int> driver(c.nbits+2, -1);
+  for(size_t i=0; i<c.cells.size(); i++) {
+    const CompiledCell& cell=c.cells[i];
+    const CanonicalTable& ct=*canonical[i];
+    LinearCell& l=linear[i];
+    l.linear=false;
+    if(cell.noutputs!=1 || ct.noutputs!=1 || ct.ninputs!=cell.ninputs) {
+      continue;
+    }
+    int out=c.portbits[cell.outputs];
+    if(out>=c.nbits || fixed[out]) {
+      continue;
+    }
+    if(driver[out]!=-1) {
+      //Two drivers, leave the net alone
+      linear[driver[out]].linear=false;
+      fixed[out]=true;
+      continue;
+    }
+    l.invert=ct.outputs[0]&1;
+    l.mask=0;
+    for(int k=0; k<ct.ninputs; k++) {
+      if((ct.outputs[(size_t)1<<k]&1)!=l.invert) {
+	l.mask|=(uint64_t)1<<k;
       }
-      if(input) {
-	inputs.push_back(bit);
-      } else {
-	outputs.push_back(bit);
+    }
+    l.linear=true;
+    for(size_t x=0; x<((size_t)1<<ct.ninputs) && l.linear; x++) {
+      l.linear=(ct.outputs[x]&1)==(l.invert^__builtin_parityll(x&l.mask));
+    }
+    if(l.linear) {
+      driver[out]=i;
+    }
+  }
+
+  //Keys of linear cells fed by other linear cells are derived after theirs
+  std::vector<int> pending(c.cells.size(), 0);
+  std::vector<std::vector<int>> fanout(c.cells.size());
+  for(size_t i=0; i<c.cells.size(); i++) {
+    if(!linear[i].linear) {
+      continue;
+    }
+    const CompiledCell& cell=c.cells[i];
+    for(int k=0; k<cell.ninputs; k++) {
+      int d=driver[c.portbits[cell.inputs+k]];
+      if(d!=-1 && linear[d].linear) {
+	fanout[d].push_back(i);
+	pending[i]++;
       }
     }
   }
-}
+  for(size_t i=0; i<c.cells.size(); i++) {
+    if(linear[i].linear && pending[i]==0) {
+      linearorder.push_back(i);
+    }
+  }
+  for(size_t q=0; q<linearorder.size(); q++) {
+    for(int f:fanout[linearorder[q]]) {
+      if(--pending[f]==0) {
+	linearorder.push_back(f);
+      }
+    }
+  }
+  //Whatever is left is on a loop and keeps its table
+  for(size_t i=0; i<c.cells.size(); i++) {
+    if(pending[i]!=0) {
+      linear[i].linear=false;
+    }
+  }
 
+  int next=0;
+  for(size_t i=0; i<c.cells.size(); i++) {
+    entryindex[i]=next;
+    next+=!linear[i].linear;
+  }
+}
 
+bool ScrambledCircuit::check_linear(const WireValues& values, int i, bool invert) const {
+  const CompiledCell& cell=c.cells[i];
+  bool v=invert;
+  for(int k=0; k<cell.ninputs; k++) {
+    if((linear[i].mask>>k)&1) {
+      v^=values.bits[c.portbits[cell.inputs+k]];
+    }
+  }
+  return values.bits[c.portbits[cell.outputs]]==v;
+}
 
+void ScrambledCircuit::get_gate_ports(const WireValues& values, const CompiledCell& cell, std::vector<bool>& inputs, std::vector<bool>& outputs) const {
+  inputs.resize(cell.ninputs);
+  outputs.resize(cell.noutputs);
+  const int* in=c.portbits.data()+cell.inputs;
+  for(int i=0; i<cell.ninputs; i++) {
+    inputs[i]=values.bits[in[i]];
+  }
+  const int* out=c.portbits.data()+cell.outputs;
+  for(int i=0; i<cell.noutputs; i++) {
+    outputs[i]=values.bits[out[i]];
+  }
+}
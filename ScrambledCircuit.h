@@ -3,25 +3,96 @@
 #include <kernel/yosys.h>
 #include <kernel/sigtools.h>
 
-#include <crypto++/osrng.h>
 #include <crypto++/modes.h>
+#include <crypto++/sha.h>
+
+#include <atomic>
 
 #include "messages.pb.h"
 
+#include "CommitmentIndex.h"
+#include "CompiledCircuit.h"
+#include "Evaluator.h"
+#include "KeystreamRNG.h"
+#include "TableCache.h"
+#include "TruthTable.h"
 #include "WireValues.h"
 
 
+/* The committed outputs in either format */
+BitView Commitment_outputs(const yosysZKP::Commitment& commitment, int noutputs);
+
+/* A cell whose single output is the XOR of the inputs in mask, inverted if
+   invert is set */
+struct LinearCell {
+  bool linear;
+  uint64_t mask;
+  bool invert;
+};
+
+/* The per round state of the prover: wire keys and the scrambled tables.
+   Rounds only share the circuit, so each can be built on its own thread. */
+struct ProofRound {
+  WireValues keys;
+
+  /* Indexed like CompiledCircuit::cells */
+  std::vector<yosysZKP::TruthTable> gates;
+
+  ProofRound(const CompiledCircuit& c);
+};
+
+/* Cells per block of a chunked round */
+#define ROUND_BLOCK_CELLS 4096
+
+/* The tables of cells [begin,end) of a chunked round */
+struct RoundBlock {
+  int begin;
+  int end;
+  /* gates[i] is the table of cell begin+i */
+  std::vector<yosysZKP::TruthTable> gates;
+
+  RoundBlock(): begin(0), end(0) {}
+};
+
 struct ScrambledCircuit {
-  CryptoPP::AutoSeededRandomPool rand;
+  KeystreamRNG keystream;
   
   Yosys::Module* m;
 
-  /* Indexed by cell name */
-  Yosys::dict<Yosys::IdString, yosysZKP::TruthTable> gatesdef;
-  Yosys::dict<Yosys::IdString, yosysZKP::TruthTable> gates;
+  CompiledCircuit c;
+  Evaluator eval;
+
+  /* Indexed like c.cells, owned by the TableCache or by tables */
+  std::vector<const yosysZKP::TruthTable*> gatesdef;
+  std::vector<const CanonicalTable*> canonical;
+
+  /* The distinct gates of a circuit loaded from a compiled file */
+  std::vector<CachedGate> tables;
 
   WireValues execution;
-  WireValues keys;
+  ProofRound round;
+
+  /* Circuits loaded from a compiled file: the hash of the source and
+     module they were compiled from, see CircuitFile.source_hash */
+  std::string source_hash;
+
+  /* Format of the rounds the prover creates, FORMAT_PACKED unless asked otherwise */
+  int format;
+
+  /* Free XOR: when set, the prover gives the linear cells no table.  Their
+     output key is instead the XOR of the keys of the inputs they XOR, so the
+     masked wire values obey the same relation; the scrambling reveal checks
+     the keys and the execution reveal the masked values.  Linear cells
+     driving an output, whose key must be zero, keep their table. */
+  bool freexor;
+  /* Indexed like c.cells */
+  std::vector<LinearCell> linear;
+  /* The cells without a table in an order where each comes after those
+     driving it */
+  std::vector<int> linearorder;
+  /* Position of each cell's entry in a free XOR execution reveal; for the
+     linear cells, that of the next entry */
+  std::vector<int> entryindex;
   
   Yosys::SigSpec allinputs;
   Yosys::SigSpec alloutputs;
@@ -29,24 +100,115 @@ struct ScrambledCircuit {
   Yosys::SigSpec allwires;
   
   ScrambledCircuit(Yosys::Module* module);
+  /* A compiled circuit, which can only execute() if every cell is a gate
+     the Evaluator handles */
+  ScrambledCircuit(const yosysZKP::CircuitFile& file);
+
+  /* The circuit in the form the compile command saves, with the hashes and
+     the module name left for the caller */
+  yosysZKP::CircuitFile serialize() const;
 
    
   Yosys::Const execute(Yosys::Const inputs);
+  /* Executes many witnesses, bit-parallel when the Evaluator handles the
+     circuit, leaving each one's execution in executions instead of in
+     execution */
+  std::vector<Yosys::Const> execute_batch(const std::vector<Yosys::Const>& inputs, std::vector<WireValues>& executions);
   
-  yosysZKP::Commitment create_proof_round();
+  /* seedout, if given, receives the KeystreamRNG::SEED_SIZE byte seed the round is built from */
+  yosysZKP::Commitment create_proof_round(unsigned char* seedout=nullptr);
 
   yosysZKP::ExecutionReveal reveal_execution();
   yosysZKP::ScramblingReveal reveal_scrambling();
 
+  /* Thread safe versions working on caller owned state, once execute() is done */
+  yosysZKP::Commitment create_proof_round(ProofRound& r, CryptoPP::RandomNumberGenerator& rng) const;
+
+  yosysZKP::ExecutionReveal reveal_execution(const ProofRound& r) const;
+  yosysZKP::ScramblingReveal reveal_scrambling(const ProofRound& r) const;
+
+  /* The keys and scrambled tables of create_proof_round without the
+     commitment, to rebuild a round from its seed */
+  void scramble_round(ProofRound& r, CryptoPP::RandomNumberGenerator& rng) const;
+
+  /* create_proof_round without the outputs, the only part that depends on
+     the witness, so rounds can be built before it is known */
+  yosysZKP::Commitment commit_round(ProofRound& r, CryptoPP::RandomNumberGenerator& rng) const;
+  /* Adds the outputs of the current execution to such a commitment */
+  void commit_outputs(yosysZKP::Commitment& commitment) const;
+  /* Rebuilds a round from its scrambling reveal, false if it does not fit the circuit */
+  bool load_round(const yosysZKP::ScramblingReveal& reveal, ProofRound& r) const;
+
+  /* Chunked rounds, for circuits too big to hold a round in one piece.  A
+     round is a header message followed by one message per block of
+     ROUND_BLOCK_CELLS cells, and parsed together they give the message of
+     an unchunked round.  The keys come from the round's keystream as in
+     scramble_round, the tables of each block from a keystream seeded with
+     the round seed and the block number, so blocks can be built and rebuilt
+     on their own, in any order. */
+  int round_blocks() const;
+  void scramble_keys(WireValues& keys, CryptoPP::RandomNumberGenerator& rng) const;
+  void scramble_block(const WireValues& keys, const std::string& seed, int block, RoundBlock& b) const;
+  /* The header: outputs, free XOR flag and block count */
+  yosysZKP::Commitment commit_chunked() const;
+  yosysZKP::Commitment commit_block(const RoundBlock& b) const;
+  /* The execution XOR the keys, what an execution reveal holds */
+  WireValues masked_execution(const WireValues& keys) const;
+  void reveal_execution_block(const WireValues& masked, const RoundBlock& b, yosysZKP::ExecutionReveal& reveal) const;
+  void reveal_scrambling_block(const RoundBlock& b, yosysZKP::ScramblingReveal& reveal) const;
+
+  /* Hash of the circuit and the current execution.  Seeded secrets record it
+     so they are only ever replayed against the same circuit and witness. */
+  std::string fingerprint() const;
+  /* The same for the circuit alone, which the verifier can compute too */
+  std::string circuit_fingerprint() const;
+
   bool validate_precommitment(const yosysZKP::Commitment& commitment, const yosysZKP::ExecutionReveal& reveal);
   bool validate_precommitment(const yosysZKP::Commitment& commitment, const yosysZKP::ScramblingReveal& reveal);
 
+  /* Re-entrant pieces of validate_precommitment, so a round can be spread
+     over several threads.  check_round does the whole round checks and fills
+     in the wire values (and for executions the commitment index), check_cells
+     then checks the cells in [begin,end).  They return an error message,
+     empty on success, and log nothing.  check_cells gives up early once
+     abort is set. */
+  std::string check_round(const yosysZKP::Commitment& commitment, const yosysZKP::ExecutionReveal& reveal, WireValues& scrambledexec, CommitmentIndex& index) const;
+  std::string check_cells(const yosysZKP::Commitment& commitment, const CommitmentIndex& index, const yosysZKP::ExecutionReveal& reveal, const WireValues& scrambledexec, int begin, int end, const std::atomic<bool>* abort=nullptr) const;
+
+  std::string check_round(const yosysZKP::Commitment& commitment, const yosysZKP::ScramblingReveal& reveal, WireValues& keys) const;
+  std::string check_cells(const yosysZKP::Commitment& commitment, const yosysZKP::ScramblingReveal& reveal, const WireValues& keys, int begin, int end, const std::atomic<bool>* abort=nullptr) const;
+
+  /* Chunked rounds are checked as they are read: check_header with the
+     header messages of the commitment and the reveal, then check_block with
+     block b of each.  Only the wire values are kept for the whole round. */
+  std::string check_header(const yosysZKP::Commitment& header, const yosysZKP::ExecutionReveal& reveal, WireValues& scrambledexec) const;
+  std::string check_block(const yosysZKP::Commitment& header, const yosysZKP::Commitment& block, const yosysZKP::ExecutionReveal& reveal, const WireValues& scrambledexec, int b) const;
+
+  std::string check_header(const yosysZKP::Commitment& header, const yosysZKP::ScramblingReveal& reveal, WireValues& keys) const;
+  std::string check_block(const yosysZKP::Commitment& header, const yosysZKP::Commitment& block, const yosysZKP::ScramblingReveal& reveal, const WireValues& keys, int b) const;
+
 private:
   void enumerate_wires();
 
+  void hash_circuit(CryptoPP::SHA256& sha) const;
+
   void initialize_cell_tables();
+  void load_cell_tables(const yosysZKP::CircuitFile& file);
+  void find_linear_cells();
+
+  bool is_free(int cell, bool freexor) const { return freexor && linear[cell].linear; }
+  /* Whether the output of a linear cell is the XOR of its inputs, inverted
+     if asked: masked values carry the inversion, keys do not */
+  bool check_linear(const WireValues& values, int cell, bool invert) const;
+
+  void get_gate_ports(const WireValues& values, const CompiledCell& cell, std::vector<bool>& inputs, std::vector<bool>& outputs) const;
+
+  /* check_cells over messages holding the cells from base on */
+  std::string check_entries(bool free, const CommitmentIndex& index, const yosysZKP::ExecutionReveal& reveal, const WireValues& scrambledexec, int begin, int end, int base, const std::atomic<bool>* abort) const;
+  std::string check_tables(bool free, const yosysZKP::Commitment& commitment, const yosysZKP::ScramblingReveal& reveal, const WireValues& keys, int begin, int end, int base, const std::atomic<bool>* abort) const;
 
-  void get_gate_ports(WireValues& values, const Yosys::Cell* cell, std::vector<bool>& inputs, std::vector<bool>& outputs, bool zeroconst=false);
+  void scramble_cell(const WireValues& keys, int n, CryptoPP::RandomNumberGenerator& rng, yosysZKP::TruthTable& table, std::vector<bool>& inputkey, std::vector<bool>& outputkey) const;
+  void add_execution_entry(const WireValues& masked, int n, const yosysZKP::TruthTable& g, yosysZKP::ExecutionReveal& exec, std::vector<bool>& inputval, std::vector<bool>& outputval) const;
 
 };
 
@@ -0,0 +1,50 @@
+#include "Stats.h"
+
+#include <stdio.h>
+
+bool stats_enabled=false;
+StatCounter stat_counters[STAT_COUNT];
+
+static const char* stat_names[STAT_COUNT]={
+  "load",
+  "cell_tables",
+  "execute",
+  "scramble",
+  "commit",
+  "reveal",
+  "validate",
+  "serialize",
+  "rounds",
+  "bytes_read",
+  "bytes_written",
+  "hashes",
+  "rng_bytes",
+};
+
+static std::chrono::steady_clock::time_point stats_started;
+
+void stats_start() {
+  stats_enabled=true;
+  stats_started=std::chrono::steady_clock::now();
+}
+
+std::string stats_json(const std::string& action) {
+  double wall=std::chrono::duration<double>(std::chrono::steady_clock::now()-stats_started).count();
+
+  char buf[128];
+  std::string json="{\n  \"action\": \""+action+"\",\n";
+  snprintf(buf, sizeof(buf), "  \"wall_seconds\": %.6f,\n  \"timers\": {", wall);
+  json+=buf;
+  for(int i=0; i<STAT_ROUNDS; i++) {
+    snprintf(buf, sizeof(buf), "%s\n    \"%s\": {\"calls\": %llu, \"seconds\": %.6f}", i ? "," : "", stat_names[i],
+	     (unsigned long long)stat_counters[i].count.load(), stat_counters[i].ns.load()*1e-9);
+    json+=buf;
+  }
+  json+="\n  },\n  \"counters\": {";
+  for(int i=STAT_ROUNDS; i<STAT_COUNT; i++) {
+    snprintf(buf, sizeof(buf), "%s\n    \"%s\": %llu", i!=STAT_ROUNDS ? "," : "", stat_names[i], (unsigned long long)stat_counters[i].count.load());
+    json+=buf;
+  }
+  json+="\n  }\n}\n";
+  return json;
+}
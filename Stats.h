@@ -0,0 +1,70 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <atomic>
+#include <chrono>
+#include <stdint.h>
+#include <string>
+
+/* Process wide timers and counters behind --stats.  Everything is a relaxed
+   atomic add at round or batch granularity, so they stay on in production;
+   when stats are off the timers do not even read the clock.  Timers on worker
+   threads add up, so they can exceed the wall time. */
+enum StatId {
+  //Timers
+  STAT_LOAD,
+  STAT_CELL_TABLES,
+  STAT_EXECUTE,
+  STAT_SCRAMBLE,
+  STAT_COMMIT,
+  STAT_REVEAL,
+  STAT_VALIDATE,
+  STAT_SERIALIZE,
+  //Counters
+  STAT_ROUNDS,
+  STAT_BYTES_READ,
+  STAT_BYTES_WRITTEN,
+  STAT_HASHES,
+  STAT_RNG_BYTES,
+  STAT_COUNT
+};
+
+struct StatCounter {
+  std::atomic<uint64_t> count;
+  std::atomic<uint64_t> ns;
+};
+
+extern bool stats_enabled;
+extern StatCounter stat_counters[STAT_COUNT];
+
+inline void stats_add(StatId id, uint64_t n=1) {
+  if(stats_enabled) {
+    stat_counters[id].count.fetch_add(n, std::memory_order_relaxed);
+  }
+}
+
+class StatTimer {
+ public:
+  StatTimer(StatId id): id(id) {
+    if(stats_enabled) {
+      start=std::chrono::steady_clock::now();
+    }
+  }
+  ~StatTimer() {
+    if(stats_enabled) {
+      uint64_t ns=std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now()-start).count();
+      stat_counters[id].count.fetch_add(1, std::memory_order_relaxed);
+      stat_counters[id].ns.fetch_add(ns, std::memory_order_relaxed);
+    }
+  }
+
+ private:
+  StatId id;
+  std::chrono::steady_clock::time_point start;
+};
+
+/* The report as a JSON object, with the wall time since stats_start */
+void stats_start();
+std::string stats_json(const std::string& action);
+
+#endif //STATS_H
@@ -0,0 +1,138 @@
+#include "TableCache.h"
+#include "TruthTable.h"
+#include "Protocol.h"
+
+#include <mutex>
+#include <unordered_map>
+
+USING_YOSYS_NAMESPACE
+
+/* Output of each gate for input number k in bit k, inputs in port name order
+   with the first port as the least significant bit, as TruthTable_from_gate
+   enumerates them. */
+static const struct {
+  const char* type;
+  int ninputs;
+  unsigned truth;
+} builtin_gates[] = {
+  {"$_BUF_",    1, 0x2},
+  {"$_NOT_",    1, 0x1},
+  {"$_AND_",    2, 0x8},
+  {"$_NAND_",   2, 0x7},
+  {"$_OR_",     2, 0xe},
+  {"$_NOR_",    2, 0x1},
+  {"$_XOR_",    2, 0x6},
+  {"$_XNOR_",   2, 0x9},
+  {"$_ANDNOT_", 2, 0x2},
+  {"$_ORNOT_",  2, 0xb},
+  {"$_MUX_",    3, 0xca},
+  {"$_NMUX_",   3, 0x35},
+  {"$_AOI3_",   3, 0x07},
+  {"$_OAI3_",   3, 0x1f},
+  {"$_AOI4_",   4, 0x0777},
+  {"$_OAI4_",   4, 0x111f},
+};
+
+static std::mutex cache_lock;
+static std::unordered_map<std::string, CachedGate> cache;
+static bool cache_dirty=false;
+
+static yosysZKP::TruthTable TruthTable_from_truth(int ninputs, unsigned truth) {
+  yosysZKP::TruthTable result;
+  for(int k=0; k<(1<<ninputs); k++) {
+    yosysZKP::TruthTableEntry* entry=result.add_entries();
+    for(int i=0; i<ninputs; i++) {
+      entry->add_inputs((k>>i)&1);
+    }
+    entry->add_outputs((truth>>k)&1);
+  }
+  return result;
+}
+
+static const CachedGate& cache_add(const std::string& key, const yosysZKP::TruthTable& table) {
+  CachedGate& g=cache[key];
+  g.table=table;
+  g.canonical=CanonicalTable_from_table(table);
+  return g;
+}
+
+static std::string cell_key(Cell* cell) {
+  std::string key=cell->type.str();
+
+  auto params=cell->parameters;
+  params.sort<RTLIL::sort_by_id_str>();
+  for(auto& p:params) {
+    key+=stringf("|%s=%s", p.first.c_str(), p.second.as_string().c_str());
+  }
+
+  auto conns=cell->connections();
+  conns.sort<RTLIL::sort_by_id_str>();
+  for(auto& conn:conns) {
+    key+=stringf("|%s:%s%s%d", conn.first.c_str(), cell->input(conn.first) ? "i" : "", cell->output(conn.first) ? "o" : "", GetSize(conn.second));
+  }
+  return key;
+}
+
+bool TableCache_builtin_truth(Cell* cell, int& ninputs, unsigned& truth) {
+  for(const auto& g:builtin_gates) {
+    if(cell->type==g.type) {
+      ninputs=g.ninputs;
+      truth=g.truth;
+      return true;
+    }
+  }
+  //A LUT is its own truth table, with A as the input number
+  if(cell->type=="$lut" && cell->getParam("\\WIDTH").as_int()<=5) {
+    ninputs=cell->getParam("\\WIDTH").as_int();
+    truth=cell->getParam("\\LUT").as_int();
+    return GetSize(cell->getPort("\\A"))==ninputs && GetSize(cell->getPort("\\Y"))==1;
+  }
+  return false;
+}
+
+const CachedGate& TableCache_get(Cell* cell) {
+  std::string key=cell_key(cell);
+
+  std::lock_guard<std::mutex> l(cache_lock);
+  auto it=cache.find(key);
+  if(it!=cache.end()) {
+    return it->second;
+  }
+
+  int ninputs;
+  unsigned truth;
+  if(TableCache_builtin_truth(cell, ninputs, truth)) {
+    return cache_add(key, TruthTable_from_truth(ninputs, truth));
+  }
+
+  cache_dirty=true;
+  return cache_add(key, TruthTable_from_gate(cell));
+}
+
+void TableCache_load(const std::string& filename) {
+  if(!std::ifstream(filename).good()) {
+    return;
+  }
+  CodedFileReader is(filename, MAGIC_TABLE_CACHE);
+
+  std::lock_guard<std::mutex> l(cache_lock);
+  yosysZKP::CachedTable t;
+  while(is.ReadFromStream(&t)) {
+    cache_add(t.key(), t.table());
+  }
+}
+
+void TableCache_save(const std::string& filename) {
+  std::lock_guard<std::mutex> l(cache_lock);
+  if(!cache_dirty) {
+    return;
+  }
+  CodedFileWriter os(filename, MAGIC_TABLE_CACHE);
+  yosysZKP::CachedTable t;
+  for(auto& it:cache) {
+    t.set_key(it.first);
+    *t.mutable_table()=it.second.table;
+    os.WriteToStream(&t);
+  }
+  cache_dirty=false;
+}
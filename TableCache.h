@@ -0,0 +1,33 @@
+#ifndef TABLE_CACHE_H
+#define TABLE_CACHE_H
+
+#include <kernel/yosys.h>
+#include <string>
+
+#include "messages.pb.h"
+#include "TruthTable.h"
+
+/* The unscrambled table of a gate, in both forms */
+struct CachedGate {
+  yosysZKP::TruthTable table;
+  CanonicalTable canonical;
+};
+
+/* Process wide cache of the unscrambled truth tables of cells, keyed by cell
+   type, parameters and port widths.  The single bit $_X_ gates come from
+   built-in tables, anything else is enumerated with TruthTable_from_gate the
+   first time its key is seen.  Returned references stay valid for the life
+   of the process. */
+const CachedGate& TableCache_get(Yosys::Cell* cell);
+
+/* The function of the single output cells that need no enumeration: output
+   for input number k in bit k, the first input port the least significant
+   bit.  These are the built-in gates and $lut cells of up to 5 inputs. */
+bool TableCache_builtin_truth(Yosys::Cell* cell, int& ninputs, unsigned& truth);
+
+/* Optional on-disk cache of the enumerated tables.  A missing file is not an
+   error; save only writes when new tables were enumerated since the load. */
+void TableCache_load(const std::string& filename);
+void TableCache_save(const std::string& filename);
+
+#endif //TABLE_CACHE_H
@@ -0,0 +1,96 @@
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(int nthreads): queued(0), pending(0), next(0), stopping(false) {
+  if(nthreads<1) {
+    nthreads=1;
+  }
+  for(int i=0; i<nthreads; i++) {
+    queues.emplace_back(new Queue());
+  }
+  for(int i=0; i<nthreads; i++) {
+    workers.emplace_back(&ThreadPool::work, this, i);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> l(lock);
+    stopping=true;
+  }
+  wake.notify_all();
+  for(std::thread& t:workers) {
+    t.join();
+  }
+}
+
+void ThreadPool::submit(Task task) {
+  unsigned int q;
+  {
+    std::lock_guard<std::mutex> l(lock);
+    q=next++ % queues.size();
+    pending++;
+  }
+  {
+    std::lock_guard<std::mutex> l(queues[q]->lock);
+    queues[q]->tasks.push_back(std::move(task));
+  }
+  {
+    std::lock_guard<std::mutex> l(lock);
+    queued++;
+  }
+  wake.notify_one();
+}
+
+void ThreadPool::wait() {
+  std::unique_lock<std::mutex> l(lock);
+  idle.wait(l, [this]{ return pending==0; });
+}
+
+bool ThreadPool::pop(int worker, Task& task) {
+  int n=queues.size();
+  for(int i=0; i<n; i++) {
+    Queue& q=*queues[(worker+i)%n];
+    std::lock_guard<std::mutex> l(q.lock);
+    if(q.tasks.empty()) {
+      continue;
+    }
+    if(i==0) {
+      task=std::move(q.tasks.back());
+      q.tasks.pop_back();
+    } else {
+      task=std::move(q.tasks.front());
+      q.tasks.pop_front();
+    }
+    return true;
+  }
+  return false;
+}
+
+void ThreadPool::work(int worker) {
+  while(true) {
+    //Claim a task before looking for it, so only as many workers as there
+    //are tasks queued go looking and the rest sleep
+    {
+      std::unique_lock<std::mutex> l(lock);
+      wake.wait(l, [this]{ return stopping || queued>0; });
+      if(queued==0) {
+	return;
+      }
+      queued--;
+    }
+
+    //A task is pushed before it is counted, so one is there; the scan can
+    //only miss it while a later one lands in a queue already passed
+    Task task;
+    while(!pop(worker, task)) {
+      std::this_thread::yield();
+    }
+
+    task(worker);
+
+    std::lock_guard<std::mutex> l(lock);
+    if(--pending==0) {
+      idle.notify_all();
+    }
+  }
+}
@@ -0,0 +1,93 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/* Fixed set of workers, each with its own task deque.  A worker pops from the
+   back of its own deque and steals from the front of the others' when it runs
+   dry.  Tasks are told which worker runs them so they can use per-worker
+   scratch state. */
+class ThreadPool {
+ public:
+  typedef std::function<void(int)> Task;
+
+  ThreadPool(int nthreads);
+  ~ThreadPool();
+
+  int size() const { return workers.size(); }
+
+  void submit(Task task);
+
+  /* Blocks until every submitted task has finished */
+  void wait();
+
+ private:
+  struct Queue {
+    std::mutex lock;
+    std::deque<Task> tasks;
+  };
+
+  std::vector<std::unique_ptr<Queue> > queues;
+  std::vector<std::thread> workers;
+
+  std::mutex lock;
+  std::condition_variable wake;
+  std::condition_variable idle;
+  int queued;
+  int pending;
+  unsigned int next;
+  bool stopping;
+
+  bool pop(int worker, Task& task);
+  void work(int worker);
+};
+
+/* Hands items from producers to consumers, blocking producers while it
+   holds capacity items.  pop returns false once the queue is closed and
+   drained. */
+template<typename T>
+class BoundedQueue {
+ public:
+  BoundedQueue(size_t capacity): capacity(capacity), closed(false) {}
+
+  void push(T item) {
+    std::unique_lock<std::mutex> l(lock);
+    notfull.wait(l, [&]{ return items.size()<capacity; });
+    items.push_back(std::move(item));
+    notempty.notify_one();
+  }
+
+  bool pop(T& item) {
+    std::unique_lock<std::mutex> l(lock);
+    notempty.wait(l, [&]{ return !items.empty() || closed; });
+    if(items.empty()) {
+      return false;
+    }
+    item=std::move(items.front());
+    items.pop_front();
+    notfull.notify_one();
+    return true;
+  }
+
+  void close() {
+    std::lock_guard<std::mutex> l(lock);
+    closed=true;
+    notempty.notify_all();
+  }
+
+ private:
+  size_t capacity;
+  bool closed;
+  std::deque<T> items;
+  std::mutex lock;
+  std::condition_variable notempty;
+  std::condition_variable notfull;
+};
+
+#endif //THREAD_POOL_H
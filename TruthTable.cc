@@ -1,5 +1,9 @@
 #include "TruthTable.h"
+#include "BatchHash.h"
+#include "Stats.h"
 
+#include <algorithm>
+#include <string.h>
 #include <crypto++/sha.h>
 #include <kernel/consteval.h>
 
@@ -100,24 +104,127 @@ yosysZKP::TruthTable TruthTable_from_gate(Cell* cell) {
 
 
 
+/* Whether the entry has one of the two shapes honest provers produce, which
+   get a hand rolled encoding.  Anything else goes through protobuf. */
+static bool TruthTableEntry_fixed_shape(const yosysZKP::TruthTableEntry& e) {
+  if(e.nonce().size()!=NONCE_SIZE) {
+    return false;
+  }
+  if(e.has_bits()) {
+    return e.inputs_size()==0 && e.outputs_size()==0 && e.bits().size()<128;
+  }
+  return true;
+}
+
+size_t TruthTableEntry_encoded_size(const yosysZKP::TruthTableEntry& e) {
+  if(!TruthTableEntry_fixed_shape(e)) {
+    return e.ByteSizeLong();
+  }
+  if(e.has_bits()) {
+    return 2+NONCE_SIZE+2+e.bits().size();
+  }
+  return 2*(e.inputs_size()+e.outputs_size())+2+NONCE_SIZE;
+}
+
+void TruthTableEntry_encode(const yosysZKP::TruthTableEntry& e, unsigned char* buf) {
+  if(!TruthTableEntry_fixed_shape(e)) {
+    e.ByteSizeLong();
+    e.SerializeWithCachedSizesToArray(buf);
+    return;
+  }
+  //Hand rolled protobuf wire format, fields in number order.  Format 1 has a
+  //tag and a one byte varint per bit, format 2 a single length delimited field
+  for(int i=0; i<e.inputs_size(); i++) {
+    *buf++=0x08;
+    *buf++=e.inputs(i);
+  }
+  for(int i=0; i<e.outputs_size(); i++) {
+    *buf++=0x10;
+    *buf++=e.outputs(i);
+  }
+  *buf++=0x1a;
+  *buf++=NONCE_SIZE;
+  memcpy(buf, e.nonce().data(), NONCE_SIZE);
+  buf+=NONCE_SIZE;
+  if(e.has_bits()) {
+    *buf++=0x22;
+    *buf++=e.bits().size();
+    memcpy(buf, e.bits().data(), e.bits().size());
+  }
+}
+
+BitView TruthTableEntry_inputs(const yosysZKP::TruthTableEntry& e, int ninputs) {
+  if(e.has_bits()) {
+    return BitView(BitView(e.bits(), e.bits().size()*8), 0, ninputs);
+  }
+  return BitView(e.inputs());
+}
+
+BitView TruthTableEntry_outputs(const yosysZKP::TruthTableEntry& e, int ninputs, int noutputs) {
+  if(e.has_bits()) {
+    return BitView(BitView(e.bits(), e.bits().size()*8), ninputs, noutputs);
+  }
+  return BitView(e.outputs());
+}
+
+bool TruthTableEntry_has_shape(const yosysZKP::TruthTableEntry& e, int ninputs, int noutputs) {
+  if(e.has_bits()) {
+    return e.inputs_size()==0 && e.outputs_size()==0 && e.bits().size()==(size_t)(ninputs+noutputs+7)/8;
+  }
+  return e.inputs_size()==ninputs && e.outputs_size()==noutputs;
+}
+
+void TruthTableEntry_pack(yosysZKP::TruthTableEntry& e) {
+  std::vector<bool> bits;
+  for(bool b:e.inputs()) {
+    bits.push_back(b);
+  }
+  for(bool b:e.outputs()) {
+    bits.push_back(b);
+  }
+  pack_bits(bits, e.mutable_bits());
+  e.clear_inputs();
+  e.clear_outputs();
+}
+
 std::string TruthTableEntry_get_commitment(const yosysZKP::TruthTableEntry& e) {
   std::string buf(SHA256::DIGESTSIZE,0);
     
-  std::string serialized=e.SerializeAsString();
-  SHA256().CalculateDigest((byte*)buf.data(),(byte*)serialized.data(),serialized.length());
+  std::vector<unsigned char> encoded(TruthTableEntry_encoded_size(e));
+  TruthTableEntry_encode(e, encoded.data());
+  SHA256().CalculateDigest((byte*)buf.data(),encoded.data(),encoded.size());
+  stats_add(STAT_HASHES);
   return buf;
 }
 
+void TruthTableEntry_get_commitments(const std::vector<const yosysZKP::TruthTableEntry*>& entries, unsigned char* digests) {
+  std::vector<size_t> offsets(entries.size()+1, 0);
+  for(size_t i=0; i<entries.size(); i++) {
+    offsets[i+1]=offsets[i]+TruthTableEntry_encoded_size(*entries[i]);
+  }
+  std::vector<unsigned char> encoded(offsets.back());
+
+  BatchHasher hasher;
+  for(size_t i=0; i<entries.size(); i++) {
+    TruthTableEntry_encode(*entries[i], &encoded[offsets[i]]);
+    hasher.add(&encoded[offsets[i]], offsets[i+1]-offsets[i], digests+i*SHA256::DIGESTSIZE);
+  }
+  hasher.flush();
+  stats_add(STAT_HASHES, entries.size());
+}
+
 bool TruthTableEntry_verify_computation(const yosysZKP::TruthTableEntry& e, const vector<bool>& i, const vector<bool>& o) {
-  if(i.size()!=(unsigned)e.inputs_size() || o.size() != (unsigned)e.outputs_size()) {
+  if(!TruthTableEntry_has_shape(e, i.size(), o.size())) {
     log_error("Tried to verify computation with wrong sized vector\n");
   }
+  BitView ein=TruthTableEntry_inputs(e, i.size());
+  BitView eout=TruthTableEntry_outputs(e, i.size(), o.size());
   for(size_t n=0; n<i.size(); n++) 
-    if(e.inputs(n)!=i[n])
+    if(ein[n]!=i[n])
       return false;
 
   for(size_t n=0; n<o.size(); n++)
-    if(e.outputs(n)!=o[n])
+    if(eout[n]!=o[n])
       return false;
   
   return true;
@@ -138,11 +245,30 @@ void TruthTableEntry_scramble(RandomNumberGenerator& rand, yosysZKP::TruthTableE
 
 
 yosysZKP::TableCommitment TruthTable_get_commitment(const yosysZKP::TruthTable& t) {
-  yosysZKP::TableCommitment tc;
-  for(int i=0; i<t.entries_size(); i++) {
-    *tc.add_entryhashes()=TruthTableEntry_get_commitment(t.entries(i));
+  google::protobuf::RepeatedPtrField<yosysZKP::TableCommitment> tc;
+  TruthTable_get_commitments(std::vector<const yosysZKP::TruthTable*>(1, &t), &tc);
+  return tc.Get(0);
+}
+
+void TruthTable_get_commitments(const std::vector<const yosysZKP::TruthTable*>& tables, google::protobuf::RepeatedPtrField<yosysZKP::TableCommitment>* out) {
+  std::vector<const yosysZKP::TruthTableEntry*> entries;
+  for(const yosysZKP::TruthTable* t:tables) {
+    for(const yosysZKP::TruthTableEntry& e:t->entries()) {
+      entries.push_back(&e);
+    }
+  }
+
+  std::vector<unsigned char> digests(entries.size()*SHA256::DIGESTSIZE);
+  TruthTableEntry_get_commitments(entries, digests.data());
+
+  const unsigned char* d=digests.data();
+  for(const yosysZKP::TruthTable* t:tables) {
+    yosysZKP::TableCommitment* tc=out->Add();
+    for(int i=0; i<t->entries_size(); i++) {
+      tc->add_entryhashes(d, SHA256::DIGESTSIZE);
+      d+=SHA256::DIGESTSIZE;
+    }
   }
-  return tc;
 }
   
 void TruthTable_scramble(yosysZKP::TruthTable& t, RandomNumberGenerator& rand, const std::vector<bool>& i, const std::vector<bool>& o) {
@@ -153,41 +279,40 @@ void TruthTable_scramble(yosysZKP::TruthTable& t, RandomNumberGenerator& rand, c
   rand.Shuffle(t.mutable_entries()->begin(), t.mutable_entries()->end());
 }
 
-bool TruthTable_contains_entry(const yosysZKP::TruthTable& tt, const yosysZKP::TruthTableEntry& entry, const std::vector<bool>& inputkey, const std::vector<bool>& outputkey) {
-
-  std::vector<bool> unscrambledinp, unscrambledoutp;
+CanonicalTable CanonicalTable_from_table(const yosysZKP::TruthTable& t) {
+  CanonicalTable ct;
+  ct.ninputs=t.entries_size()>0 ? t.entries(0).inputs_size() : 0;
+  ct.noutputs=t.entries_size()>0 ? t.entries(0).outputs_size() : 0;
+  ct.words=(ct.noutputs+63)/64;
+  if(ct.ninputs>16 || t.entries_size()!=(1<<ct.ninputs)) {
+    log_error("Truth table is not in canonical form\n");
+  }
+  ct.outputs.assign((size_t)t.entries_size()*ct.words, 0);
 
-  for(int i=0; i<entry.inputs_size(); i++)
-    unscrambledinp.push_back(entry.inputs(i)^inputkey[i]);
-  for(int i=0; i<entry.outputs_size(); i++)
-    unscrambledoutp.push_back(entry.outputs(i)^outputkey[i]);
-  int min=0, max=tt.entries_size()-1;
+  std::vector<uint64_t> words;
+  for(int k=0; k<t.entries_size(); k++) {
+    const yosysZKP::TruthTableEntry& e=t.entries(k);
+    if(!TruthTableEntry_has_shape(e, ct.ninputs, ct.noutputs) || BitView(e.inputs()).word(0, ct.ninputs)!=(uint64_t)k) {
+      log_error("Truth table is not in canonical form\n");
+    }
+    std::vector<bool> out(e.outputs().begin(), e.outputs().end());
+    pack_words(out, words);
+    std::copy(words.begin(), words.end(), ct.outputs.data()+(size_t)k*ct.words);
+  }
+  return ct;
+}
 
-  while(max>min) {
-    int ave=min+(max-min)/2;
-    const yosysZKP::TruthTableEntry& compentry=tt.entries(ave);
+bool CanonicalTable_contains_entry(const CanonicalTable& ct, const yosysZKP::TruthTableEntry& entry, uint64_t inputkey, const uint64_t* outputkey) {
+  BitView ein=TruthTableEntry_inputs(entry, ct.ninputs);
+  BitView eout=TruthTableEntry_outputs(entry, ct.ninputs, ct.noutputs);
 
-    bool equal=true;
-    for(int i=compentry.inputs_size()-1; i>=0; i--) {
-      if(compentry.inputs(i) && !unscrambledinp[i]) {
-	equal=false;
-	max=ave-1;
-	break;
-      }
-      if(!compentry.inputs(i) && unscrambledinp[i]) {
-	equal=false;
-	min=ave+1;
-	break;
-      }
-    }
-    if(equal) {
-      min=ave;
-      max=ave;
+  //Not operator[], outputs is empty for a table without outputs
+  const uint64_t* row=ct.outputs.data()+(ein.word(0, ct.ninputs)^inputkey)*ct.words;
+  for(int w=0; w<ct.words; w++) {
+    int count=std::min(64, ct.noutputs-64*w);
+    if((eout.word(64*w, count)^outputkey[w])!=row[w]) {
+      return false;
     }
   }
-  if(max!=min) {
-    return false;
-  }
-  const yosysZKP::TruthTableEntry& comp=tt.entries(min);
-  return TruthTableEntry_verify_computation(comp, unscrambledinp, unscrambledoutp);
+  return true;
 }
@@ -4,20 +4,50 @@
 #include <kernel/yosys.h>
 #include <cryptopp/cryptlib.h>
 #include "messages.pb.h"
+#include "Bits.h"
 
 #define NONCE_SIZE 16
 
 //TruthTableEntry {
    std::string TruthTableEntry_get_commitment(const yosysZKP::TruthTableEntry& e);
+   /* Hashes many entries in one batch, SHA256::DIGESTSIZE bytes per entry into digests */
+   void TruthTableEntry_get_commitments(const std::vector<const yosysZKP::TruthTableEntry*>& entries, unsigned char* digests);
+   /* The bytes that get hashed, which are exactly the protobuf serialization */
+   size_t TruthTableEntry_encoded_size(const yosysZKP::TruthTableEntry& e);
+   void TruthTableEntry_encode(const yosysZKP::TruthTableEntry& e, unsigned char* buf);
+   /* Views of an entry's bits in either format.  Check the shape first. */
+   bool TruthTableEntry_has_shape(const yosysZKP::TruthTableEntry& e, int ninputs, int noutputs);
+   BitView TruthTableEntry_inputs(const yosysZKP::TruthTableEntry& e, int ninputs);
+   BitView TruthTableEntry_outputs(const yosysZKP::TruthTableEntry& e, int ninputs, int noutputs);
+   /* Converts a format 1 entry to format 2 */
+   void TruthTableEntry_pack(yosysZKP::TruthTableEntry& e);
    bool TruthTableEntry_verify_computation(const yosysZKP::TruthTableEntry& e, const std::vector<bool>& i, const std::vector<bool>&o);
-   void TruthTableEntry_scramble(const CryptoPP::RandomNumberGenerator& rng, yosysZKP::TruthTableEntry& e, const std::vector<bool>& i, const std::vector<bool>& o);
+   void TruthTableEntry_scramble(CryptoPP::RandomNumberGenerator& rng, yosysZKP::TruthTableEntry& e, const std::vector<bool>& i, const std::vector<bool>& o);
 //}
 
 //TruthTable {
    yosysZKP::TruthTable TruthTable_from_gate(Yosys::Cell* cell);
    yosysZKP::TableCommitment TruthTable_get_commitment(const yosysZKP::TruthTable& t);
+   /* Commitments for many tables, hashed together in one batch */
+   void TruthTable_get_commitments(const std::vector<const yosysZKP::TruthTable*>& tables, google::protobuf::RepeatedPtrField<yosysZKP::TableCommitment>* out);
    void TruthTable_scramble(yosysZKP::TruthTable& t, CryptoPP::RandomNumberGenerator& rand, const std::vector<bool>& i, const std::vector<bool>& o);
-   bool TruthTable_contains_entry(const yosysZKP::TruthTable& tt, const yosysZKP::TruthTableEntry& entry, const std::vector<bool>& inputkey, const std::vector<bool>& outputkey);
    void TruthTable_check(const yosysZKP::TruthTable& t);
 //}
+
+/* A canonical table as the packed outputs for each input word, so finding
+   the row of an entry is a single index.  Rows are words 64 bit words each. */
+struct CanonicalTable {
+  int ninputs;
+  int noutputs;
+  int words;
+  std::vector<uint64_t> outputs;
+};
+
+//CanonicalTable {
+   /* t must be ordered by input word, as TruthTable_from_gate builds it */
+   CanonicalTable CanonicalTable_from_table(const yosysZKP::TruthTable& t);
+   /* Whether the entry, unscrambled with the given keys, is a row of the
+      table.  The entry must have the table's shape. */
+   bool CanonicalTable_contains_entry(const CanonicalTable& ct, const yosysZKP::TruthTableEntry& entry, uint64_t inputkey, const uint64_t* outputkey);
+//}
 #endif //TRUTH_TABLE_H
@@ -3,22 +3,29 @@
 
 USING_YOSYS_NAMESPACE
 
-WireValues::WireValues(Module* module):m(module) {
-
+WireValues::WireValues(const CompiledCircuit& circuit, bool mask):c(&circuit), bits(circuit.nbits+2, false) {
+  bits[c->const1()]=!mask;
 }
-yosysZKP::WireValues WireValues::serialize()  const {
+yosysZKP::WireValues WireValues::serialize(int format)  const {
   yosysZKP::WireValues ex;
-  for(const auto& it : map) {
-    ex.add_entries(it.second);
+  if(format==FORMAT_PACKED) {
+    pack_bits(std::vector<bool>(bits.begin(), bits.begin()+c->nbits), ex.mutable_packed());
+    return ex;
+  }
+  ex.mutable_entries()->Reserve(c->nbits);
+  for(int i=0; i<c->nbits; i++) {
+    ex.add_entries(bits[i]);
   }
   
   return ex;
 }
-void WireValues::deserialize(const yosysZKP::WireValues& ex) {
-  map.clear();
-  int i=0;
-  for(const auto& it:m->wires()) {
-    map[it->name]=ex.entries(i++);
+bool WireValues::deserialize(const yosysZKP::WireValues& ex) {
+  BitView view=ex.has_packed() ? BitView(ex.packed(), c->nbits) : BitView(ex.entries());
+  if(view.size()!=c->nbits || (ex.has_packed() && ex.entries_size()!=0)) {
+    return false;
+  }
+  for(int i=0; i<c->nbits; i++) {
+    bits[i]=view[i];
   }
-  map.sort();
+  return true;
 }
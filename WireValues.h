@@ -5,15 +5,21 @@
 
 #include "messages.pb.h"
 
+#include "Bits.h"
+#include "CompiledCircuit.h"
+
+/* One bit per wire bit of a CompiledCircuit, plus the two constant bits.
+   A mask holds zero for both constants, otherwise they hold their value. */
 struct WireValues {
-  Yosys::Module* m;
-  
-  Yosys::dict<Yosys::IdString, unsigned char> map;
-
-  WireValues(Yosys::Module* module);
-  
-  yosysZKP::WireValues serialize()  const;
-  void deserialize(const yosysZKP::WireValues& ex);
+  const CompiledCircuit* c;
+
+  std::vector<bool> bits;
+
+  WireValues(const CompiledCircuit& circuit, bool mask=false);
+
+  yosysZKP::WireValues serialize(int format=FORMAT_PACKED)  const;
+  /* Reads either format */
+  bool deserialize(const yosysZKP::WireValues& ex);
 
 };
 
@@ -0,0 +1,242 @@
+#!/usr/bin/env python3
+"""Scaling benchmark for yosysZKP.
+
+Generates parameterized circuits (adders, multipliers, comparators and
+SHA-256 compression rounds), synthesizes them to gates with yosys, then runs
+every protocol phase with a fixed seed.  Each phase becomes one JSON object
+per line with its wall time, throughput in gates*rounds/s, peak RSS and the
+size of the files it wrote.
+
+  python3 bench.py [--yosysZKP ./yosysZKP] [--out results.jsonl]
+                   [--circuits adder:8,32,128 mult:8,16] [--rounds 16,64]
+                   [--threads 1,4]
+"""
+
+import argparse
+import json
+import os
+import random
+import re
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+SEED = "yosysZKP-bench"
+
+MASK32 = 0xffffffff
+
+SHA256_K = [
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+]
+
+
+# Each generator returns (verilog, [(port, width)] inputs, output width, function)
+# where function maps the input port values to the output value.
+
+def gen_adder(n):
+    v = "module top(input [%d:0] a, input [%d:0] b, output [%d:0] y);\n" % (n-1, n-1, n)
+    v += "  assign y = a + b;\nendmodule\n"
+    return v, [("a", n), ("b", n)], n+1, lambda a, b: a+b
+
+
+def gen_mult(n):
+    v = "module top(input [%d:0] a, input [%d:0] b, output [%d:0] y);\n" % (n-1, n-1, 2*n-1)
+    v += "  assign y = a * b;\nendmodule\n"
+    return v, [("a", n), ("b", n)], 2*n, lambda a, b: a*b
+
+
+def gen_compare(n):
+    v = "module top(input [%d:0] a, input [%d:0] b, output y);\n" % (n-1, n-1)
+    v += "  assign y = a < b;\nendmodule\n"
+    return v, [("a", n), ("b", n)], 1, lambda a, b: int(a < b)
+
+
+def rotr_v(x, n):
+    return "{%s[%d:0], %s[31:%d]}" % (x, n-1, x, n)
+
+
+def rotr(x, n):
+    return ((x >> n) | (x << (32-n))) & MASK32
+
+
+def sha256_rounds(h, m, rounds):
+    """Model of gen_sha: word i of h and m is bits [32i+31:32i]"""
+    w = [(m >> (32*i)) & MASK32 for i in range(16)]
+    for t in range(16, rounds):
+        s0 = rotr(w[t-15], 7) ^ rotr(w[t-15], 18) ^ (w[t-15] >> 3)
+        s1 = rotr(w[t-2], 17) ^ rotr(w[t-2], 19) ^ (w[t-2] >> 10)
+        w.append((w[t-16] + s0 + w[t-7] + s1) & MASK32)
+    init = [(h >> (32*i)) & MASK32 for i in range(8)]
+    a, b, c, d, e, f, g, hh = init
+    for t in range(rounds):
+        S1 = rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)
+        ch = (e & f) ^ (~e & g)
+        t1 = (hh + S1 + ch + SHA256_K[t] + w[t]) & MASK32
+        S0 = rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)
+        maj = (a & b) ^ (a & c) ^ (b & c)
+        t2 = (S0 + maj) & MASK32
+        a, b, c, d, e, f, g, hh = (t1+t2) & MASK32, a, b, c, (d+t1) & MASK32, e, f, g
+    out = 0
+    for i, x in enumerate([a, b, c, d, e, f, g, hh]):
+        out |= ((init[i] + x) & MASK32) << (32*i)
+    return out
+
+
+def gen_sha(rounds):
+    """The first rounds rounds of a SHA-256 compression, with the feed forward"""
+    lines = ["module top(input [255:0] h, input [511:0] m, output [255:0] y);"]
+    w = []
+    for t in range(rounds):
+        name = "w%d" % t
+        if t < 16:
+            lines.append("  wire [31:0] %s = m[%d:%d];" % (name, 32*t+31, 32*t))
+        else:
+            x, z = w[t-15], w[t-2]
+            lines.append("  wire [31:0] %s = %s + (%s ^ %s ^ (%s >> 3)) + %s + (%s ^ %s ^ (%s >> 10));" % (
+                name, w[t-16], rotr_v(x, 7), rotr_v(x, 18), x, w[t-7], rotr_v(z, 17), rotr_v(z, 19), z))
+        w.append(name)
+    state = []
+    for i in range(8):
+        lines.append("  wire [31:0] h%d = h[%d:%d];" % (i, 32*i+31, 32*i))
+        state.append("h%d" % i)
+    for t in range(rounds):
+        a, b, c, d, e, f, g, hh = state
+        lines.append("  wire [31:0] t1_%d = %s + (%s ^ %s ^ %s) + ((%s & %s) ^ (~%s & %s)) + 32'h%08x + %s;" % (
+            t, hh, rotr_v(e, 6), rotr_v(e, 11), rotr_v(e, 25), e, f, e, g, SHA256_K[t], w[t]))
+        lines.append("  wire [31:0] t2_%d = (%s ^ %s ^ %s) + ((%s & %s) ^ (%s & %s) ^ (%s & %s));" % (
+            t, rotr_v(a, 2), rotr_v(a, 13), rotr_v(a, 22), a, b, a, c, b, c))
+        lines.append("  wire [31:0] a%d = t1_%d + t2_%d;" % (t+1, t, t))
+        lines.append("  wire [31:0] e%d = %s + t1_%d;" % (t+1, d, t))
+        state = ["a%d" % (t+1), a, b, c, "e%d" % (t+1), e, f, g]
+    for i in range(8):
+        lines.append("  assign y[%d:%d] = h%d + %s;" % (32*i+31, 32*i, i, state[i]))
+    lines.append("endmodule")
+    return "\n".join(lines)+"\n", [("h", 256), ("m", 512)], 256, lambda h, m: sha256_rounds(h, m, rounds)
+
+
+GENERATORS = {
+    "adder": gen_adder,
+    "mult": gen_mult,
+    "compare": gen_compare,
+    "sha": gen_sha,
+}
+
+
+def bits_lsb_first(value, width):
+    return "".join("1" if (value >> i) & 1 else "0" for i in range(width))
+
+
+def synthesize(verilog, workdir):
+    src = os.path.join(workdir, "gen.v")
+    out = os.path.join(workdir, "gen_synth.v")
+    with open(src, "w") as f:
+        f.write(verilog)
+    subprocess.check_call(["yosys", "-q", "-p",
+                           "read_verilog %s; synth -flatten -top top; abc -g simple; opt_clean; "
+                           "write_verilog -noattr -noexpr %s" % (src, out)])
+    with open(out) as f:
+        gates = len(re.findall(r"^\s*\\\$_\w+_\s", f.read(), re.M))
+    return out, gates
+
+
+def run_phase(cmd):
+    """Runs cmd, returning wall seconds and peak RSS in KiB"""
+    start = time.monotonic()
+    proc = subprocess.Popen(cmd, stdout=subprocess.DEVNULL)
+    _, status, usage = os.wait4(proc.pid, 0)
+    elapsed = time.monotonic()-start
+    if status != 0:
+        sys.exit("Benchmark phase failed: %s" % " ".join(cmd))
+    return elapsed, usage.ru_maxrss
+
+
+def file_bytes(*paths):
+    return sum(os.path.getsize(p) for p in paths if os.path.exists(p))
+
+
+def bench_circuit(args, out, name, size):
+    workdir = tempfile.mkdtemp(prefix="zkpbench")
+    try:
+        verilog, inputs, outwidth, func = GENERATORS[name](size)
+        circuit, gates = synthesize(verilog, workdir)
+
+        rng = random.Random("%s:%s:%d" % (SEED, name, size))
+        values = [rng.getrandbits(width) for _, width in inputs]
+        result = func(*values) & ((1 << outwidth)-1)
+        infile = os.path.join(workdir, "inputs.dat")
+        outfile = os.path.join(workdir, "outputs.dat")
+        with open(infile, "w") as f:
+            f.write("".join(bits_lsb_first(v, w) for v, (_, w) in zip(values, inputs))+"\n")
+        with open(outfile, "w") as f:
+            f.write(bits_lsb_first(result, outwidth)+"\n")
+
+        def p(name):
+            return os.path.join(workdir, name)
+
+        for rounds in args.rounds:
+            for threads in args.threads:
+                common = ["-j", str(threads), "-seed", SEED]
+                phases = [
+                    ("prover_create", [args.yosysZKP, "prover_create"]+common+[circuit, "top", infile, outfile, str(rounds), p("s.secret"), p("s.comm")], [p("s.secret"), p("s.comm")]),
+                    ("provee_respond", [args.yosysZKP, "provee_respond", "-seed", SEED, p("s.comm"), p("s.state"), p("s.resp")], [p("s.state"), p("s.resp")]),
+                    ("prover_reveal", [args.yosysZKP, "prover_reveal", p("s.secret"), p("s.resp"), p("s.reveal")], [p("s.reveal")]),
+                    ("provee_validate", [args.yosysZKP, "provee_validate", "-j", str(threads), circuit, "top", outfile, str(rounds), p("s.state"), p("s.reveal")], []),
+                    ("prove", [args.yosysZKP, "prove"]+common+[circuit, "top", infile, outfile, str(rounds), p("s.proof")], [p("s.proof")]),
+                    ("verify", [args.yosysZKP, "verify", "-j", str(threads), circuit, "top", outfile, str(rounds), p("s.proof")], []),
+                ]
+                for phase, cmd, outputs in phases:
+                    seconds, rss = run_phase(cmd)
+                    record = {
+                        "circuit": name,
+                        "size": size,
+                        "gates": gates,
+                        "rounds": rounds,
+                        "threads": threads,
+                        "phase": phase,
+                        "seconds": round(seconds, 6),
+                        "gate_rounds_per_s": round(gates*rounds/seconds, 1) if seconds > 0 else None,
+                        "peak_rss_kib": rss,
+                        "bytes": file_bytes(*outputs),
+                    }
+                    out.write(json.dumps(record)+"\n")
+                    out.flush()
+    finally:
+        shutil.rmtree(workdir)
+
+
+def int_list(s):
+    return [int(x) for x in s.split(",")]
+
+
+def main():
+    parser = argparse.ArgumentParser(description="yosysZKP scaling benchmark")
+    parser.add_argument("--yosysZKP", default="./yosysZKP")
+    parser.add_argument("--out", help="JSON lines output file, stdout by default")
+    parser.add_argument("--circuits", nargs="+", default=["adder:8,32,128", "mult:8,16,32", "compare:32,128", "sha:4,16,64"],
+                        help="name:size,size,... with name one of %s (sha sizes are rounds)" % ", ".join(sorted(GENERATORS)))
+    parser.add_argument("--rounds", type=int_list, default=[16, 64])
+    parser.add_argument("--threads", type=int_list, default=[1, os.cpu_count() or 1])
+    args = parser.parse_args()
+    args.yosysZKP = os.path.abspath(args.yosysZKP)
+    args.threads = sorted(set(args.threads))
+
+    out = open(args.out, "w") if args.out else sys.stdout
+    for spec in args.circuits:
+        name, sizes = spec.split(":")
+        if name not in GENERATORS:
+            sys.exit("Unknown circuit %s" % name)
+        for size in int_list(sizes):
+            bench_circuit(args, out, name, size)
+
+
+if __name__ == "__main__":
+    main()
@@ -1,8 +1,25 @@
 #include "Protocol.h"
 
+#include "Daemon.h"
+#include "FiatShamir.h"
+#include "LutPack.h"
 #include "ScrambledCircuit.h"
+#include "Stats.h"
+#include "TableCache.h"
+#include "ThreadPool.h"
 
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <sys/file.h>
 
+
+#include <crypto++/osrng.h>
 #include <google/protobuf/io/zero_copy_stream_impl.h>
 #include <google/protobuf/io/coded_stream.h>
 
@@ -28,8 +45,12 @@ Const const_from_file(std::string filename) {
 }
 
 
-Module* load_module(std::string filename, std::string modulename) {
-  Design* design=yosys_get_design();
+/* lutsize, if not 0, packs the gates into LUTs of up to that many inputs.
+   Every file gets a design of its own, which the circuit built from the
+   module keeps referring to, so the same module can be loaded twice. */
+Module* load_module(std::string filename, std::string modulename, int lutsize) {
+  StatTimer timer(STAT_LOAD);
+  Design* design=new Design;
   Yosys::run_frontend(filename, "auto", design);
   Pass::call(design, "hierarchy -check");
   Pass::call(design, "splitnets -ports");
@@ -40,71 +61,1355 @@ Module* load_module(std::string filename, std::string modulename) {
   if(result==nullptr) {
     log_error("Could not find module %s in file\n",modulename.c_str());
   }
+  if(lutsize>0) {
+    LutPack_run(result, lutsize);
+  }
   return result;
 }
 
+std::string hex(const std::string& data) {
+  std::string result;
+  for(unsigned char ch:data) {
+    result+=stringf("%02x", ch);
+  }
+  return result;
+}
 
+/* Binds a compiled circuit to the module and source file it came from */
+std::string source_hash(const std::string& filename, const std::string& modulename) {
+  std::ifstream in(filename, std::ios::binary);
+  if(!in) {
+    log_error("Could not open %s\n", filename.c_str());
+  }
+  std::string contents((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
 
-int main(int argc, char** argv)
-{
-  if(argc < 5) {
-    printf("Usage:\n");
-    printf("%s prover_create file.v module inputs.dat outputs.dat security_param out.secret out.comm \n",argv[0]);
-    printf("%s provee_respond in.comm provee.state out.resp\n",argv[0]);
-    printf("%s prover_reveal in.secret in.resp out.reveal\n",argv[0]);
-    printf("%s provee_validate file.v module outputs.dat security_param provee.state in.reveal\n",argv[0]);
+  CryptoPP::SHA256 sha;
+  sha.Update((const unsigned char*)modulename.c_str(), modulename.size()+1);
+  sha.Update((const unsigned char*)contents.data(), contents.size());
+  std::string result(CryptoPP::SHA256::DIGESTSIZE, 0);
+  sha.Final((unsigned char*)&result[0]);
+  return result;
+}
+
+bool is_compiled_circuit(const std::string& filename) {
+  std::ifstream in(filename, std::ios::binary);
+  unsigned char magic[8];
+  if(!in.read((char*)magic, sizeof(magic))) {
+    return false;
+  }
+  uint64_t m=0;
+  for(int i=7; i>=0; i--) {
+    m=(m<<8)|magic[i];
+  }
+  return m==MAGIC_CIRCUIT;
+}
+
+struct Options {
+  int threads;
+  bool seeded;
+  bool freexor;
+  /* 0 leaves the gates as they are */
+  int lutsize;
+  std::string tablecache;
+  std::string seed;
+  /* "-" for stderr */
+  std::string stats;
+  /* Rounds to validate, last -1 for all of them */
+  int first;
+  int last;
+  std::string checkpoint;
+  std::string result;
+  /* Precomputed rounds to prove with */
+  std::string pool;
+  /* Write rounds in blocks, see ScrambledCircuit::round_blocks */
+  bool chunked;
+  /* The source file a compiled circuit must have been compiled from */
+  std::string source;
+
+  Options(): threads(1), seeded(false), freexor(false), lutsize(0), first(0), last(-1), chunked(false) {}
+
+  bool ranged() const { return first!=0 || last!=-1 || !checkpoint.empty() || !result.empty(); }
+};
+
+/* Circuits a daemon loaded before serving, which every request it forks
+   shares copy on write, by resident_key */
+static std::map<std::string, std::shared_ptr<ScrambledCircuit>> resident;
+
+static std::string resident_key(const std::string& filename, const std::string& modulename, int lutsize) {
+  char* path=realpath(filename.c_str(), nullptr);
+  std::string key=path ? path : filename;
+  free(path);
+  return key+'\0'+modulename+'\0'+std::to_string(lutsize);
+}
+
+std::shared_ptr<ScrambledCircuit> read_circuit(const std::string& filename, const std::string& modulename, int lutsize) {
+  auto it=resident.find(resident_key(filename, modulename, lutsize));
+  if(it!=resident.end()) {
+    log("Using resident circuit %s\n", modulename.c_str());
+    return it->second;
+  }
+  if(!is_compiled_circuit(filename)) {
+    return std::shared_ptr<ScrambledCircuit>(new ScrambledCircuit(load_module(filename, modulename, lutsize)));
+  }
+  if(lutsize>0) {
+    log_warning("-lut is ignored for compiled circuits, pack them when compiling instead\n");
+  }
+
+  yosysZKP::CircuitFile file;
+  {
+    StatTimer timer(STAT_LOAD);
+    CodedFileReader is(filename, MAGIC_CIRCUIT);
+    if(!is.ReadFromStream(&file)) {
+      log_error("Could not read compiled circuit %s\n", filename.c_str());
+    }
+  }
+  if(file.module()!=modulename) {
+    log_error("%s was compiled from module %s, not %s\n", filename.c_str(), file.module().c_str(), modulename.c_str());
+  }
+
+  std::shared_ptr<ScrambledCircuit> circuit(new ScrambledCircuit(file));
+  circuit->source_hash=file.source_hash();
+  if(circuit->circuit_fingerprint()!=file.circuit_hash()) {
+    log_error("Compiled circuit %s does not match its hash\n", filename.c_str());
+  }
+  log("Loaded compiled circuit %s\n", hex(file.circuit_hash()).c_str());
+  return circuit;
+}
+
+/* The circuit of a source file, or of a file written by compile in its
+   place, which skips the frontend altogether.  With -source a compiled
+   circuit must have been compiled from that file. */
+std::shared_ptr<ScrambledCircuit> load_circuit(const std::string& filename, const std::string& modulename, const Options& opts) {
+  std::shared_ptr<ScrambledCircuit> circuit=read_circuit(filename, modulename, opts.lutsize);
+  if(!opts.source.empty()) {
+    if(circuit->source_hash.empty()) {
+      log_warning("-source is ignored, %s is not a compiled circuit\n", filename.c_str());
+    } else if(circuit->source_hash!=source_hash(opts.source, modulename)) {
+      log_error("%s was not compiled from module %s of %s\n", filename.c_str(), modulename.c_str(), opts.source.c_str());
+    }
+  }
+  return circuit;
+}
+
+/* Whether the committed outputs are the agreed upon ones */
+bool outputs_match(const yosysZKP::Commitment& commitment, const Const& outputs) {
+  BitView committed=Commitment_outputs(commitment, outputs.size());
+  if(committed.size()!=outputs.size()) {
+    return false;
+  }
+  for(int i=0; i<outputs.size(); i++) {
+    if((outputs.bits[i]==State::S1)!=committed[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+
+/* Pulls the options out of the command line, leaving only positional arguments */
+std::vector<std::string> parse_options(const std::vector<std::string>& argv, Options& opts) {
+  std::vector<std::string> args;
+  for(size_t i=0; i<argv.size(); i++) {
+    const std::string& arg=argv[i];
+    if(arg=="-j" && i+1<argv.size()) {
+      opts.threads=atoi(argv[++i].c_str());
+      if(opts.threads<1) {
+	opts.threads=std::thread::hardware_concurrency();
+      }
+    } else if(arg=="-s") {
+      opts.seeded=true;
+    } else if(arg=="-c" && i+1<argv.size()) {
+      opts.tablecache=argv[++i];
+    } else if(arg=="--stats") {
+      opts.stats="-";
+    } else if(arg.compare(0, 8, "--stats=")==0) {
+      opts.stats=arg.substr(8);
+    } else if(arg=="-freexor") {
+      opts.freexor=true;
+    } else if(arg=="-chunked") {
+      opts.chunked=true;
+    } else if(arg=="-lut" && i+1<argv.size()) {
+      opts.lutsize=atoi(argv[++i].c_str());
+      if(opts.lutsize<2 || opts.lutsize>EVAL_LUT_INPUTS) {
+	fprintf(stderr, "-lut takes 2 to %d inputs, so the evaluator can still run the circuit\n", EVAL_LUT_INPUTS);
+	exit(1);
+      }
+    } else if(arg=="-range" && i+1<argv.size()) {
+      if(sscanf(argv[++i].c_str(), "%d:%d", &opts.first, &opts.last)!=2 || opts.first<0 || opts.last<opts.first) {
+	fprintf(stderr, "Bad round range %s, expected first:last\n", argv[i].c_str());
+	exit(1);
+      }
+    } else if(arg=="-checkpoint" && i+1<argv.size()) {
+      opts.checkpoint=argv[++i];
+    } else if(arg=="-result" && i+1<argv.size()) {
+      opts.result=argv[++i];
+    } else if(arg=="-source" && i+1<argv.size()) {
+      opts.source=argv[++i];
+    } else if(arg=="-pool" && i+1<argv.size()) {
+      opts.pool=argv[++i];
+    } else if(arg=="-seed" && i+1<argv.size()) {
+      opts.seed=argv[++i];
+    } else {
+      args.push_back(arg);
+    }
+  }
+  return args;
+}
+
+/* A pool for ordered_parallel, or none to run everything on the caller */
+std::unique_ptr<ThreadPool> make_pool(int threads) {
+  return std::unique_ptr<ThreadPool>(threads>1 ? new ThreadPool(threads) : nullptr);
+}
+
+/* Runs work(i, worker, result) for every i in [0,n) and hands the results to
+   emit in order.  With a pool the work runs on it, keeping only a few items
+   per worker in flight so memory stays bounded. */
+template<typename T>
+void ordered_parallel(int n, ThreadPool* pool, std::function<void(int, int, T&)> work, std::function<void(int, T&)> emit) {
+  if(pool==nullptr) {
+    for(int i=0; i<n; i++) {
+      T result;
+      work(i, 0, result);
+      emit(i, result);
+    }
+    return;
+  }
+
+  struct Item {
+    T result;
+    bool done;
+  };
+
+  std::mutex lock;
+  std::condition_variable ready;
+  std::vector<Item> items(n);
+
+  int window=4*pool->size();
+  int submitted=0;
+  for(int i=0; i<n; i++) {
+    for(; submitted<n && submitted<i+window; submitted++) {
+      Item* item=&items[submitted];
+      int k=submitted;
+      item->done=false;
+      pool->submit([&, item, k](int worker) {
+	  work(k, worker, item->result);
+
+	  std::lock_guard<std::mutex> l(lock);
+	  item->done=true;
+	  ready.notify_all();
+	});
+    }
+
+    Item& item=items[i];
+    {
+      std::unique_lock<std::mutex> l(lock);
+      ready.wait(l, [&item]{ return item.done; });
+    }
+    emit(i, item.result);
+    item.result=T();
+  }
+  pool->wait();
+}
+
+/* ordered_parallel split in two stages: build(i, worker, message) and then,
+   as a task of its own, encode(i, message, result).  A worker is free for
+   the next build as soon as its message is done, while another one encodes
+   it; the window of items in flight covers both stages. */
+template<typename M, typename T>
+void ordered_pipeline(int n, ThreadPool* pool, std::function<void(int, int, M&)> build, std::function<void(int, M&, T&)> encode, std::function<void(int, T&)> emit) {
+  if(pool==nullptr) {
+    for(int i=0; i<n; i++) {
+      M message;
+      T result;
+      build(i, 0, message);
+      encode(i, message, result);
+      emit(i, result);
+    }
+    return;
+  }
+
+  struct Item {
+    M message;
+    T result;
+    bool done;
+  };
+
+  std::mutex lock;
+  std::condition_variable ready;
+  std::vector<Item> items(n);
+
+  int window=4*pool->size();
+  int submitted=0;
+  for(int i=0; i<n; i++) {
+    for(; submitted<n && submitted<i+window; submitted++) {
+      Item* item=&items[submitted];
+      int k=submitted;
+      item->done=false;
+      pool->submit([&, item, k](int worker) {
+	  build(k, worker, item->message);
+	  pool->submit([&, item, k](int) {
+	      encode(k, item->message, item->result);
+	      item->message=M();
+
+	      std::lock_guard<std::mutex> l(lock);
+	      item->done=true;
+	      ready.notify_all();
+	    });
+	});
+    }
+
+    Item& item=items[i];
+    {
+      std::unique_lock<std::mutex> l(lock);
+      ready.wait(l, [&item]{ return item.done; });
+    }
+    emit(i, item.result);
+    item.result=T();
+  }
+  pool->wait();
+}
+
+/* A round built but not serialized yet */
+struct RoundMessages {
+  yosysZKP::Commitment comm;
+  yosysZKP::ProverSecret sec;
+  std::string seed;
+};
+
+/* A round already serialized by the pipeline that built it, so emitting it
+   only moves bytes to the writers */
+struct RoundOutput {
+  std::string comm;
+  std::string sec;
+  std::string seed;
+};
+
+template<typename T>
+void serialize_into(const T& message, std::string& out) {
+  StatTimer timer(STAT_SERIALIZE);
+  message.SerializeToString(&out);
+}
+
+/* For the blocks of a chunked round, which leave out the required fields
+   their header holds */
+template<typename T>
+void serialize_block_into(const T& message, std::string& out) {
+  StatTimer timer(STAT_SERIALIZE);
+  message.SerializePartialToString(&out);
+}
+
+/* The encoding stage of the round pipelines */
+void serialize_round(RoundMessages& round, RoundOutput& out) {
+  serialize_into(round.comm, out.comm);
+  serialize_into(round.sec, out.sec);
+  out.seed.swap(round.seed);
+}
+
+/* Builds the proof rounds, each worker with its own keystream and scratch
+   round, and emits them in round order.  If seeded the secret only holds the
+   round's seed, which is also in seed.  A fixedseed makes the rounds
+   repeatable, for benchmarks. */
+void create_rounds(const ScrambledCircuit& circuit, int security_param, ThreadPool* pool, bool seeded, const std::string& fixedseed, std::function<void(int, RoundOutput&)> emit) {
+  int workers=pool ? pool->size() : 1;
+  std::vector<std::unique_ptr<KeystreamRNG> > rngs;
+  std::vector<std::unique_ptr<ProofRound> > scratch;
+  for(int w=0; w<workers; w++) {
+    rngs.emplace_back(new KeystreamRNG());
+    scratch.emplace_back(new ProofRound(circuit.c));
+  }
+
+  ordered_pipeline<RoundMessages, RoundOutput>(security_param, pool, [&](int i, int worker, RoundMessages& out) {
+      ProofRound& r=*scratch[worker];
+      unsigned char seed[KeystreamRNG::SEED_SIZE];
+      if(fixedseed.empty()) {
+	rngs[worker]->Reseed(seed);
+      } else {
+	rngs[worker]->SeedFrom("round:"+fixedseed, i, seed);
+      }
+      out.comm=circuit.create_proof_round(r, *rngs[worker]);
+      if(seeded) {
+	out.seed.assign((const char*)seed, sizeof(seed));
+	out.sec.set_seed(out.seed);
+      } else {
+	*out.sec.mutable_execution()=circuit.reveal_execution(r);
+	*out.sec.mutable_scrambling()=circuit.reveal_scrambling(r);
+      }
+    }, [](int i, RoundMessages& round, RoundOutput& out) {
+      serialize_round(round, out);
+    }, emit);
+}
+
+/* Rebuilds rounds from their seeds and emits the half of each that was
+   asked for, as a serialized ProverSecret with only that half set */
+void reveal_seeded_rounds(const ScrambledCircuit& circuit, const std::vector<std::string>& seeds, const std::vector<bool>& scrambling, ThreadPool* pool, std::function<void(int, std::string&)> emit) {
+  int workers=pool ? pool->size() : 1;
+  std::vector<std::unique_ptr<KeystreamRNG> > rngs;
+  std::vector<std::unique_ptr<ProofRound> > scratch;
+  for(int w=0; w<workers; w++) {
+    rngs.emplace_back(new KeystreamRNG());
+    scratch.emplace_back(new ProofRound(circuit.c));
+  }
+
+  ordered_parallel<std::string>(scrambling.size(), pool, [&](int i, int worker, std::string& out) {
+      ProofRound& r=*scratch[worker];
+      rngs[worker]->Seed((const unsigned char*)seeds[i].data());
+      circuit.scramble_round(r, *rngs[worker]);
+      yosysZKP::ProverSecret reveal;
+      if(scrambling[i]) {
+	*reveal.mutable_scrambling()=circuit.reveal_scrambling(r);
+      } else {
+	*reveal.mutable_execution()=circuit.reveal_execution(r);
+      }
+      serialize_into(reveal, out);
+    }, emit);
+}
+
+/* A fresh round seed, from the operating system unless fixedseed makes
+   the rounds repeatable */
+std::string new_round_seed(int i, const std::string& fixedseed) {
+  KeystreamRNG rng;
+  unsigned char seed[KeystreamRNG::SEED_SIZE];
+  if(fixedseed.empty()) {
+    rng.Reseed(seed);
+  } else {
+    rng.SeedFrom("round:"+fixedseed, i, seed);
+  }
+  return std::string((const char*)seed, sizeof(seed));
+}
+
+/* The parts of a chunked round chunked_round builds */
+enum {
+  BLOCK_COMMIT=1,
+  BLOCK_EXECUTION=2,
+  BLOCK_SCRAMBLING=4
+};
+
+/* Builds the chunked round of seed and emits its header and then each of
+   its blocks in order, with the commitment in comm if asked for and a
+   ProverSecret with the halves asked for in sec.  The blocks are built on
+   the pool a few per worker at a time, so a round is never held whole. */
+void chunked_round(const ScrambledCircuit& circuit, const std::string& seed, int parts, ThreadPool* pool, std::function<void(RoundOutput&)> emit) {
+  bool secret=(parts&(BLOCK_EXECUTION|BLOCK_SCRAMBLING))!=0;
+
+  KeystreamRNG rng;
+  rng.Seed((const unsigned char*)seed.data());
+  WireValues keys(circuit.c, true);
+  {
+    StatTimer timer(STAT_SCRAMBLE);
+    circuit.scramble_keys(keys, rng);
+  }
+  WireValues masked(circuit.c);
+  if(parts&BLOCK_EXECUTION) {
+    masked=circuit.masked_execution(keys);
+  }
+
+  RoundOutput header;
+  if(parts&BLOCK_COMMIT) {
+    serialize_into(circuit.commit_chunked(), header.comm);
+  }
+  if(secret) {
+    yosysZKP::ProverSecret sec;
+    sec.set_blocks(circuit.round_blocks());
+    if(parts&BLOCK_EXECUTION) {
+      *sec.mutable_execution()->mutable_exec()=masked.serialize(circuit.format);
+    }
+    if(parts&BLOCK_SCRAMBLING) {
+      *sec.mutable_scrambling()->mutable_keys()=keys.serialize(circuit.format);
+    }
+    serialize_into(sec, header.sec);
+  }
+  emit(header);
+
+  std::vector<RoundBlock> scratch(pool ? pool->size() : 1);
+  ordered_parallel<RoundOutput>(circuit.round_blocks(), pool, [&](int k, int worker, RoundOutput& out) {
+      RoundBlock& b=scratch[worker];
+      circuit.scramble_block(keys, seed, k, b);
+      if(parts&BLOCK_COMMIT) {
+	serialize_block_into(circuit.commit_block(b), out.comm);
+      }
+      if(secret) {
+	yosysZKP::ProverSecret sec;
+	if(parts&BLOCK_EXECUTION) {
+	  circuit.reveal_execution_block(masked, b, *sec.mutable_execution());
+	}
+	if(parts&BLOCK_SCRAMBLING) {
+	  circuit.reveal_scrambling_block(b, *sec.mutable_scrambling());
+	}
+	serialize_block_into(sec, out.sec);
+      }
+    }, [&](int, RoundOutput& out) { emit(out); });
+}
+
+/* Builds rounds before the witness is known and emits them as serialized
+   PrecomputedRounds, holding the seed of each round if seeded and its
+   scrambling reveal otherwise */
+void precompute_rounds(const ScrambledCircuit& circuit, int rounds, ThreadPool* pool, bool seeded, const std::string& fixedseed, std::function<void(int, std::string&)> emit) {
+  int workers=pool ? pool->size() : 1;
+  std::vector<std::unique_ptr<KeystreamRNG> > rngs;
+  std::vector<std::unique_ptr<ProofRound> > scratch;
+  for(int w=0; w<workers; w++) {
+    rngs.emplace_back(new KeystreamRNG());
+    scratch.emplace_back(new ProofRound(circuit.c));
+  }
+
+  ordered_parallel<std::string>(rounds, pool, [&](int i, int worker, std::string& out) {
+      ProofRound& r=*scratch[worker];
+      unsigned char seed[KeystreamRNG::SEED_SIZE];
+      if(fixedseed.empty()) {
+	rngs[worker]->Reseed(seed);
+      } else {
+	rngs[worker]->SeedFrom("round:"+fixedseed, i, seed);
+      }
+      yosysZKP::PrecomputedRound round;
+      *round.mutable_commitment()=circuit.commit_round(r, *rngs[worker]);
+      if(seeded) {
+	round.mutable_secret()->set_seed((const char*)seed, sizeof(seed));
+      } else {
+	*round.mutable_secret()->mutable_scrambling()=circuit.reveal_scrambling(r);
+      }
+      serialize_into(round, out);
+    }, emit);
+}
+
+/* Opens filename and locks it, for as long as the descriptor stays open,
+   against every other process taking rounds from it.  A lock taken on a
+   pool that was replaced or deleted while waiting is dropped and retried. */
+static int lock_pool(const std::string& filename) {
+  while(true) {
+    int fd=open(filename.c_str(), O_RDONLY);
+    if(fd<0) {
+      log_error("Could not open pool %s\n", filename.c_str());
+    }
+    while(flock(fd, LOCK_EX)!=0) {
+      if(errno!=EINTR) {
+	log_error("Could not lock pool %s: %s\n", filename.c_str(), strerror(errno));
+      }
+    }
+    struct stat locked, current;
+    if(fstat(fd, &locked)==0 && stat(filename.c_str(), &current)==0 &&
+       locked.st_dev==current.st_dev && locked.st_ino==current.st_ino) {
+      return fd;
+    }
+    close(fd);
+  }
+}
+
+/* The first rounds of a pool file, still serialized.  A round used for two
+   witnesses would give away how they differ, so the rounds taken are
+   removed from the file under a lock before anything else can read it. */
+struct PoolRounds {
+  int lock;
+  CodedFileReader in;
+  yosysZKP::PoolHeader header;
+  std::vector<std::pair<const char*, size_t> > raw;
+
+  PoolRounds(const std::string& filename, const ScrambledCircuit& circuit, int rounds): lock(lock_pool(filename)), in(filename, MAGIC_POOL) {
+    if(!in.ReadFromStream(&header)) {
+      log_error("Could not read pool header\n");
+    }
+    if(header.circuit()!=circuit.circuit_fingerprint()) {
+      log_error("Pool %s was built for another circuit\n", filename.c_str());
+    }
+    if(header.rounds()<rounds) {
+      log_error("Pool %s holds %d rounds but %d are needed\n", filename.c_str(), header.rounds(), rounds);
+    }
+    for(int i=0; i<rounds; i++) {
+      const char* data;
+      size_t size;
+      if(!in.ReadRawFromStream(&data, &size)) {
+	log_error("Pool %s is truncated\n", filename.c_str());
+      }
+      raw.push_back(std::make_pair(data, size));
+    }
+    //The rounds taken leave the pool before they are used, the rest stay.
+    //The mapping keeps the old contents readable after the rename.
+    int left=header.rounds()-rounds;
+    if(left==0) {
+      if(unlink(filename.c_str())!=0) {
+	log_error("Could not delete pool %s, refusing to use its rounds twice\n", filename.c_str());
+      }
+    } else {
+      std::vector<char> name(filename.begin(), filename.end());
+      const char suffix[]=".XXXXXX";
+      name.insert(name.end(), suffix, suffix+sizeof(suffix));
+      int fd=mkstemp(name.data());
+      if(fd<0) {
+	log_error("Could not create a file next to pool %s: %s\n", filename.c_str(), strerror(errno));
+      }
+      close(fd);
+      std::string tmp(name.data());
+      {
+	CodedFileWriter os(tmp, MAGIC_POOL);
+	yosysZKP::PoolHeader rest=header;
+	rest.set_rounds(left);
+	os.WriteToStream(&rest);
+	for(int i=0; i<left; i++) {
+	  std::string round;
+	  if(!in.ReadRawFromStream(&round)) {
+	    log_error("Pool %s is truncated\n", filename.c_str());
+	  }
+	  os.WriteRawToStream(round);
+	}
+      }
+      if(rename(tmp.c_str(), filename.c_str())!=0) {
+	log_error("Could not rewrite pool %s, refusing to use its rounds twice\n", filename.c_str());
+      }
+    }
+    close(lock);
+    log("Took %d precomputed rounds from %s, %d left\n", rounds, filename.c_str(), left);
+  }
+
+  /* Round i, false if it is damaged */
+  bool parse(int i, yosysZKP::PrecomputedRound& round) const {
+    if(raw[i].second>INT_MAX || !round.ParseFromArray(raw[i].first, raw[i].second)) {
+      return false;
+    }
+    if(header.seeded()) {
+      return round.secret().seed().size()==KeystreamRNG::SEED_SIZE;
+    }
+    return round.secret().has_scrambling();
+  }
+};
+
+/* Finishes the rounds of a pool with the outputs of the circuit's current
+   execution and emits them like create_rounds.  Scrambling reveals become
+   full secrets, with the execution reveal looked up from the tables. */
+void finish_pool_rounds(const ScrambledCircuit& circuit, const PoolRounds& rounds, ThreadPool* pool, std::function<void(int, RoundOutput&)> emit) {
+  int workers=pool ? pool->size() : 1;
+  std::vector<std::unique_ptr<ProofRound> > scratch;
+  for(int w=0; w<workers; w++) {
+    scratch.emplace_back(new ProofRound(circuit.c));
+  }
+
+  std::vector<char> damaged(rounds.raw.size(), 0);
+  ordered_pipeline<RoundMessages, RoundOutput>(rounds.raw.size(), pool, [&](int i, int worker, RoundMessages& out) {
+      yosysZKP::PrecomputedRound round;
+      ProofRound& r=*scratch[worker];
+      if(!rounds.parse(i, round) || (!rounds.header.seeded() && !circuit.load_round(round.secret().scrambling(), r))) {
+	damaged[i]=1;
+	return;
+      }
+      out.comm.Swap(round.mutable_commitment());
+      circuit.commit_outputs(out.comm);
+
+      if(rounds.header.seeded()) {
+	out.seed=round.secret().seed();
+	out.sec.set_seed(out.seed);
+      } else {
+	*out.sec.mutable_execution()=circuit.reveal_execution(r);
+	out.sec.mutable_scrambling()->Swap(round.mutable_secret()->mutable_scrambling());
+      }
+    }, [&](int i, RoundMessages& round, RoundOutput& out) {
+      if(!damaged[i]) {
+	serialize_round(round, out);
+      }
+    }, [&](int i, RoundOutput& out) {
+      if(damaged[i]) {
+	log_error("Round %d of the pool is damaged\n", i);
+      }
+      emit(i, out);
+    });
+}
+
+/* The half of each pool round that was asked for, for pools of scrambling
+   reveals, emitted like reveal_seeded_rounds */
+void reveal_pool_rounds(const ScrambledCircuit& circuit, const PoolRounds& rounds, const std::vector<bool>& scrambling, ThreadPool* pool, std::function<void(int, std::string&)> emit) {
+  int workers=pool ? pool->size() : 1;
+  std::vector<std::unique_ptr<ProofRound> > scratch;
+  for(int w=0; w<workers; w++) {
+    scratch.emplace_back(new ProofRound(circuit.c));
+  }
+
+  std::vector<char> damaged(scrambling.size(), 0);
+  ordered_parallel<std::string>(scrambling.size(), pool, [&](int i, int worker, std::string& out) {
+      yosysZKP::PrecomputedRound round;
+      ProofRound& r=*scratch[worker];
+      if(!rounds.parse(i, round) || !circuit.load_round(round.secret().scrambling(), r)) {
+	damaged[i]=1;
+	return;
+      }
+      yosysZKP::ProverSecret reveal;
+      if(scrambling[i]) {
+	reveal.mutable_scrambling()->Swap(round.mutable_secret()->mutable_scrambling());
+      } else {
+	*reveal.mutable_execution()=circuit.reveal_execution(r);
+      }
+      serialize_into(reveal, out);
+    }, [&](int i, std::string& out) {
+      if(damaged[i]) {
+	log_error("Round %d of the pool is damaged\n", i);
+      }
+      emit(i, out);
+    });
+}
+
+/* One round as it comes off the files, still serialized and pointing into
+   the readers' mappings.  The state is either a ProveeState, or when bare a
+   Commitment with the requested half in scrambling. */
+struct RawRound {
+  const char* state;
+  size_t statesize;
+  bool bare;
+  bool scrambling;
+
+  const char* reveal;
+  size_t revealsize;
+
+  /* Index digests to check the messages against, if not null */
+  const unsigned char* statedigest;
+  const unsigned char* revealdigest;
+
+  RawRound(): state(nullptr), statesize(0), bare(false), scrambling(false), reveal(nullptr), revealsize(0), statedigest(nullptr), revealdigest(nullptr) {}
+};
+
+/* Validates rounds on a thread pool.  The reader only splits the streams into
+   raw rounds; parsing, hashing and the per cell checks happen on the workers,
+   with big rounds split into chunks of cells.  The first failure stops every
+   worker and is reported once they have all returned. */
+int validate_rounds_parallel(const ScrambledCircuit& circuit, const Const& outputs, int threads, std::function<bool(RawRound&)> next_state, std::function<bool(RawRound&)> next_reveal) {
+  const int chunksize=1024;
+
+  struct RoundJob {
+    RawRound raw;
+    yosysZKP::ProveeState state;
+    yosysZKP::ProverSecret secret;
+    std::unique_ptr<WireValues> values;
+    CommitmentIndex index;
+    std::atomic<int> chunks;
+
+    RoundJob(): chunks(0) {}
+  };
+
+  std::atomic<bool> failed(false);
+  std::string error;
+  std::mutex lock;
+  std::condition_variable done;
+  int inflight=0;
+
+  auto fail=[&](const std::string& e) {
+    std::lock_guard<std::mutex> l(lock);
+    if(!failed) {
+      error=e;
+      failed=true;
+    }
+  };
+  auto finish_round=[&]() {
+    std::lock_guard<std::mutex> l(lock);
+    inflight--;
+    done.notify_all();
+  };
+  auto check_chunk=[&](std::shared_ptr<RoundJob> job, int begin, int end) {
+    std::string e;
+    if(job->state.scrambling()) {
+      e=circuit.check_cells(job->state.commitment(), job->secret.scrambling(), *job->values, begin, end, &failed);
+    } else {
+      e=circuit.check_cells(job->state.commitment(), job->index, job->secret.execution(), *job->values, begin, end, &failed);
+    }
+    if(!e.empty()) {
+      fail(e);
+    }
+    if(--job->chunks==0) {
+      finish_round();
+    }
+  };
+
+  ThreadPool pool(threads);
+  int window=4*pool.size();
+  int count=0;
+  while(!failed) {
+    std::shared_ptr<RoundJob> job(new RoundJob());
+    if(!next_state(job->raw)) {
+      break;
+    }
+    if(!next_reveal(job->raw)) {
+      fail("Mismatch between commitment and reveal!");
+      break;
+    }
+    count++;
+
+    {
+      std::unique_lock<std::mutex> l(lock);
+      done.wait(l, [&]{ return inflight<window; });
+      inflight++;
+    }
+    pool.submit([&, job](int) {
+	std::string e;
+	if(failed) {
+	  finish_round();
+	  return;
+	}
+	const RawRound& raw=job->raw;
+	bool parsed=true;
+	if((raw.statedigest!=nullptr && !message_digest_matches(raw.state, raw.statesize, raw.statedigest)) ||
+	   (raw.revealdigest!=nullptr && !message_digest_matches(raw.reveal, raw.revealsize, raw.revealdigest))) {
+	  e="Round does not match the file index";
+	} else if(raw.statesize>INT_MAX || raw.revealsize>INT_MAX) {
+	  parsed=false;
+	} else if(raw.bare) {
+	  job->state.set_scrambling(raw.scrambling);
+	  parsed=job->state.mutable_commitment()->ParseFromArray(raw.state, raw.statesize);
+	} else {
+	  parsed=job->state.ParseFromArray(raw.state, raw.statesize);
+	}
+	if(!e.empty()) {
+	} else if(!parsed || !job->secret.ParseFromArray(raw.reveal, raw.revealsize)) {
+	  e="Could not parse proof round";
+	} else if(!outputs_match(job->state.commitment(), outputs)) {
+	  e="Outputs do not match requirements";
+	}
+	if(e.empty()) {
+	  job->values.reset(new WireValues(circuit.c, job->state.scrambling()));
+	  if(job->state.scrambling()) {
+	    e=circuit.check_round(job->state.commitment(), job->secret.scrambling(), *job->values);
+	  } else {
+	    e=circuit.check_round(job->state.commitment(), job->secret.execution(), *job->values, job->index);
+	  }
+	}
+	if(!e.empty()) {
+	  fail(e);
+	  finish_round();
+	  return;
+	}
+
+	int ncells=circuit.c.cells.size();
+	int nchunks=std::max(1, (ncells+chunksize-1)/chunksize);
+	job->chunks=nchunks;
+	for(int k=1; k<nchunks; k++) {
+	  int begin=k*chunksize;
+	  int end=std::min(ncells, begin+chunksize);
+	  pool.submit([&, job, begin, end](int) { check_chunk(job, begin, end); });
+	}
+	check_chunk(job, 0, std::min(ncells, chunksize));
+      });
+  }
+  pool.wait();
+
+  if(failed) {
+    log_error("%s\n", error.c_str());
+  }
+  return count;
+}
+
+/* Validates chunked rounds, reading the states and the reveals in lockstep.
+   Each block is parsed and checked on its own, a few per worker at a time,
+   so besides the circuit only the wire values of a round and the file
+   positions of its blocks are held.  Without challenges the states are
+   ProveeStates, with them bare commitments of challenges->size() rounds. */
+int validate_chunked_rounds(const ScrambledCircuit& circuit, const Const& outputs, ThreadPool* pool, CodedFileReader& ss, CodedFileReader& rs, const std::vector<bool>* challenges) {
+  bool bare=challenges!=nullptr;
+  int count=0;
+  yosysZKP::ProveeState state;
+  yosysZKP::ProverSecret secret;
+  for(; !bare || count<(int)challenges->size(); count++) {
+    bool read=bare ? ss.ReadFromStream(state.mutable_commitment()) : ss.ReadFromStream(&state);
+    if(!read && !bare) {
+      break;
+    }
+    if(!read || !rs.ReadFromStream(&secret)) {
+      log_error("Mismatch between commitment and reveal!\n");
+    }
+    if(bare) {
+      state.set_scrambling((*challenges)[count]);
+    }
+    const yosysZKP::Commitment& header=state.commitment();
+    bool scrambling=state.scrambling();
+    if(!outputs_match(header, outputs)) {
+      log_error("Outputs do not match requirements\n");
+    }
+
+    WireValues values(circuit.c, scrambling);
+    std::string e;
+    if(scrambling) {
+      e=circuit.check_header(header, secret.scrambling(), values);
+    } else {
+      e=circuit.check_header(header, secret.execution(), values);
+    }
+    if(!e.empty()) {
+      log_error("%s\n", e.c_str());
+    }
+
+    //The files are mapped, so the blocks are only located here
+    std::vector<RawRound> blocks(header.blocks());
+    for(RawRound& raw:blocks) {
+      if(!ss.ReadRawFromStream(&raw.state, &raw.statesize) || !rs.ReadRawFromStream(&raw.reveal, &raw.revealsize)) {
+	log_error("Mismatch between commitment and reveal!\n");
+      }
+    }
+
+    ordered_parallel<std::string>(blocks.size(), pool, [&](int k, int, std::string& error) {
+	const RawRound& raw=blocks[k];
+	yosysZKP::ProveeState block;
+	yosysZKP::ProverSecret reveal;
+	bool parsed;
+	{
+	  StatTimer timer(STAT_SERIALIZE);
+	  parsed=raw.statesize<=INT_MAX && raw.revealsize<=INT_MAX &&
+	    (bare ? block.mutable_commitment()->ParsePartialFromArray(raw.state, raw.statesize) : block.ParsePartialFromArray(raw.state, raw.statesize)) &&
+	    reveal.ParsePartialFromArray(raw.reveal, raw.revealsize);
+	}
+	if(!parsed) {
+	  error="Could not parse proof round";
+	} else if(scrambling) {
+	  error=circuit.check_block(header, block.commitment(), reveal.scrambling(), values, k);
+	} else {
+	  error=circuit.check_block(header, block.commitment(), reveal.execution(), values, k);
+	}
+      }, [&](int, std::string& error) {
+	if(!error.empty()) {
+	  log_error("%s\n", error.c_str());
+	}
+      });
+  }
+  return count;
+}
+
+/* The rounds of an indexed pair of state and reveal streams.  Round k is
+   message statebase+k of the states and revealbase+k of the reveals; bare
+   states are commitments, with the requests in challenges. */
+struct IndexedRounds {
+  CodedFileReader& ss;
+  int statebase;
+  CodedFileReader& rs;
+  int revealbase;
+  int rounds;
+  const std::vector<bool>* challenges;
+
+  IndexedRounds(CodedFileReader& ss, int statebase, CodedFileReader& rs, int revealbase, int rounds, const std::vector<bool>* challenges):
+    ss(ss), statebase(statebase), rs(rs), revealbase(revealbase), rounds(rounds), challenges(challenges) {
+    if(!ss.has_index() || !rs.has_index()) {
+      log_error("Round ranges need files with a round index, written by a newer version\n");
+    }
+    //Seeks must find the messages a sequential read would, which for a
+    //proof are the commitments the challenges were hashed from, and the
+    //reveals must be the last messages of the file
+    if(!ss.index_is_sequential() || !rs.index_is_sequential()) {
+      log_error("Round index does not match the messages of the file\n");
+    }
+    if(rounds<0 || ss.indexed_messages()<(size_t)(statebase+rounds) || rs.indexed_messages()!=(size_t)(revealbase+rounds)) {
+      log_error("Round index does not cover every round\n");
+    }
+  }
+
+  /* Binds a range of rounds to the files' contents */
+  std::string digest(int first, int last) const {
+    CryptoPP::SHA256 sha;
+    for(int k=first; k<last; k++) {
+      sha.Update(ss.indexed_digest(statebase+k), CryptoPP::SHA256::DIGESTSIZE);
+      sha.Update(rs.indexed_digest(revealbase+k), CryptoPP::SHA256::DIGESTSIZE);
+    }
+    std::string result(CryptoPP::SHA256::DIGESTSIZE, 0);
+    sha.Final((unsigned char*)&result[0]);
+    return result;
+  }
+};
+
+/* A result with only the statement set: the circuit, the outputs and the
+   security parameter rounds are validated against */
+yosysZKP::ValidationResult result_statement(const ScrambledCircuit& circuit, const Const& outputs, int security_param) {
+  yosysZKP::ValidationResult result;
+  result.set_circuit(circuit.circuit_fingerprint());
+  std::vector<bool> bits;
+  for(State s:outputs.bits) {
+    bits.push_back(s==State::S1);
+  }
+  pack_bits(bits, result.mutable_outputs());
+  result.set_security_param(security_param);
+  return result;
+}
+
+bool same_statement(const yosysZKP::ValidationResult& a, const yosysZKP::ValidationResult& b) {
+  return a.circuit()==b.circuit() && a.outputs()==b.outputs() && a.security_param()==b.security_param();
+}
+
+void write_result(const std::string& filename, const yosysZKP::ValidationResult& statement, const IndexedRounds& rounds, int first, int last) {
+  yosysZKP::ValidationResult result=statement;
+  result.set_first(first);
+  result.set_last(last);
+  result.set_digest(rounds.digest(first, last));
+
+  //Replace the old file in one step, so a crash never leaves half a checkpoint
+  std::string tmp=filename+".tmp";
+  {
+    CodedFileWriter os(tmp, MAGIC_RESULT);
+    os.WriteToStream(&result);
+  }
+  if(rename(tmp.c_str(), filename.c_str())!=0) {
+    log_error("Could not write %s\n", filename.c_str());
+  }
+}
+
+/* Validates the rounds given by -range, all of them by default, in chunks.
+   With -checkpoint the progress is saved after each chunk and a rerun picks
+   up after the last saved one; with -result the validated range is recorded
+   for provee_merge/verify_merge.  Returns the number of rounds validated. */
+int validate_range(const ScrambledCircuit& circuit, const Const& outputs, int security_param, const Options& opts, const IndexedRounds& rounds) {
+  const int chunkrounds=64;
+  yosysZKP::ValidationResult statement=result_statement(circuit, outputs, security_param);
+
+  int first=opts.first;
+  int last=opts.last==-1 ? rounds.rounds : opts.last;
+  if(last>rounds.rounds) {
+    log_error("Range %d:%d is past the %d rounds of the proof\n", first, last, rounds.rounds);
+  }
+
+  int start=first;
+  if(!opts.checkpoint.empty() && std::ifstream(opts.checkpoint).good()) {
+    CodedFileReader cp(opts.checkpoint, MAGIC_RESULT);
+    yosysZKP::ValidationResult saved;
+    if(cp.ReadFromStream(&saved) && same_statement(saved, statement) &&
+       saved.first()==first && saved.last()>=first && saved.last()<=last &&
+       saved.digest()==rounds.digest(first, saved.last())) {
+      start=saved.last();
+      log("Resuming validation at round %d\n", start);
+    } else {
+      log_warning("Checkpoint %s does not match these files, starting over\n", opts.checkpoint.c_str());
+    }
+  }
+
+  for(int chunk=start; chunk<last; chunk+=chunkrounds) {
+    int end=std::min(last, chunk+chunkrounds);
+    int next=chunk;
+    int nextreveal=chunk;
+    int count=validate_rounds_parallel(circuit, outputs, opts.threads,
+				       [&](RawRound& r) {
+					 if(next==end) {
+					   return false;
+					 }
+					 rounds.ss.Seek(rounds.statebase+next);
+					 if(!rounds.ss.ReadRawFromStream(&r.state, &r.statesize)) {
+					   return false;
+					 }
+					 r.statedigest=rounds.ss.indexed_digest(rounds.statebase+next);
+					 if(rounds.challenges!=nullptr) {
+					   r.bare=true;
+					   r.scrambling=(*rounds.challenges)[next];
+					 }
+					 next++;
+					 return true;
+				       },
+				       [&](RawRound& r) {
+					 rounds.rs.Seek(rounds.revealbase+nextreveal);
+					 if(!rounds.rs.ReadRawFromStream(&r.reveal, &r.revealsize)) {
+					   return false;
+					 }
+					 r.revealdigest=rounds.rs.indexed_digest(rounds.revealbase+nextreveal);
+					 nextreveal++;
+					 return true;
+				       });
+    if(count!=end-chunk) {
+      log_error("Mismatch between commitment and reveal!\n");
+    }
+    if(!opts.checkpoint.empty()) {
+      write_result(opts.checkpoint, statement, rounds, first, end);
+    }
+  }
+
+  if(!opts.result.empty()) {
+    write_result(opts.result, statement, rounds, first, last);
+  }
+  log("Validated rounds %d to %d\n", first, last);
+  return last-first;
+}
+
+/* Checks that range results together cover every round of the files, all
+   validated against statement */
+void merge_results(const IndexedRounds& rounds, const yosysZKP::ValidationResult& statement, const std::vector<std::string>& files) {
+  std::vector<yosysZKP::ValidationResult> results;
+  for(const std::string& f:files) {
+    CodedFileReader rs(f, MAGIC_RESULT);
+    yosysZKP::ValidationResult r;
+    if(!rs.ReadFromStream(&r)) {
+      log_error("Could not read result %s\n", f.c_str());
+    }
+    if(!same_statement(r, statement)) {
+      log_error("Result %s was made for a different circuit, outputs or security parameter\n", f.c_str());
+    }
+    results.push_back(r);
+  }
+  std::sort(results.begin(), results.end(), [](const yosysZKP::ValidationResult& a, const yosysZKP::ValidationResult& b) {
+      return a.first()<b.first();
+    });
+
+  int covered=0;
+  for(const yosysZKP::ValidationResult& r:results) {
+    if(r.first()!=covered || r.last()<r.first() || r.last()>rounds.rounds) {
+      log_error("Results do not cover rounds %d onwards exactly once\n", covered);
+    }
+    if(r.digest()!=rounds.digest(r.first(), r.last())) {
+      log_error("Result for rounds %d to %d was made for different files\n", r.first(), r.last());
+    }
+    covered=r.last();
+  }
+  if(covered!=rounds.rounds) {
+    log_error("Results stop at round %d of %d\n", covered, rounds.rounds);
+  }
+
+  if(covered>=statement.security_param()) {
+    log("SUCCESS: Proven with confidence 2^-%d\n",covered);
+  } else {
+    log_error("Not enough proof rounds to satisfy security requirement\n");
+  }
+}
+
+/* Writes a non-interactive proof that the circuit's current execution gives
+   outputs, committing to every round and keeping only the seeds to rebuild
+   the challenged halves from.  Chunked rounds are built one at a time. */
+void prove_execution(const ScrambledCircuit& circuit, const Const& outputs, int security_param, ThreadPool* pool, const std::string& fixedseed, const std::string& filename, bool chunked, const PoolRounds* precomputed=nullptr) {
+  AsyncFileWriter ps(filename,MAGIC_PROOF,!chunked);
+  yosysZKP::ProofHeader header;
+  header.set_rounds(security_param);
+  if(chunked) {
+    header.set_chunked(true);
+  }
+  ps.WriteToStream(&header);
+
+  ChallengeHasher hasher(circuit.circuit_fingerprint(), outputs, security_param);
+  std::vector<std::string> seeds;
+  auto commit=[&](int, RoundOutput& round) {
+    hasher.add_commitment(round.comm.data(), round.comm.size());
+    ps.WriteRawToStream(std::move(round.comm));
+    seeds.push_back(round.seed);
+  };
+  auto reveal=[&](int, std::string& reveal) {
+    ps.WriteRawToStream(std::move(reveal));
+  };
+
+  if(chunked) {
+    //Every message of a chunked commitment is hashed
+    for(int i=0; i<security_param; i++) {
+      seeds.push_back(new_round_seed(i, fixedseed));
+      chunked_round(circuit, seeds[i], BLOCK_COMMIT, pool, [&](RoundOutput& out) {
+	  hasher.add_commitment(out.comm.data(), out.comm.size());
+	  ps.WriteRawToStream(std::move(out.comm));
+	});
+    }
+    std::vector<bool> challenges=hasher.challenges();
+    for(int i=0; i<security_param; i++) {
+      chunked_round(circuit, seeds[i], challenges[i] ? BLOCK_SCRAMBLING : BLOCK_EXECUTION, pool, [&](RoundOutput& out) {
+	  ps.WriteRawToStream(std::move(out.sec));
+	});
+    }
+    return;
+  }
+
+  if(precomputed==nullptr) {
+    create_rounds(circuit, security_param, pool, true, fixedseed, commit);
+  } else {
+    finish_pool_rounds(circuit, *precomputed, pool, commit);
+  }
+
+  if(precomputed==nullptr || precomputed->header.seeded()) {
+    reveal_seeded_rounds(circuit, seeds, hasher.challenges(), pool, reveal);
+  } else {
+    reveal_pool_rounds(circuit, *precomputed, hasher.challenges(), pool, reveal);
+  }
+}
+
+/* One line of a prove_batch manifest */
+struct BatchWitness {
+  std::string inputs;
+  std::string outputs;
+  std::string proof;
+};
+
+/* Lines of inputs.dat outputs.dat out.proof; blank lines and lines starting
+   with # are skipped */
+std::vector<BatchWitness> read_manifest(const std::string& filename) {
+  std::ifstream in(filename);
+  if(!in) {
+    log_error("Could not open %s\n", filename.c_str());
+  }
+  std::vector<BatchWitness> result;
+  std::string line;
+  for(int lineno=1; std::getline(in, line); lineno++) {
+    std::istringstream fields(line);
+    BatchWitness w;
+    std::string extra;
+    if(!(fields>>w.inputs) || w.inputs[0]=='#') {
+      continue;
+    }
+    if(!(fields>>w.outputs>>w.proof) || (fields>>extra)) {
+      log_error("%s:%d: expected inputs.dat outputs.dat out.proof\n", filename.c_str(), lineno);
+    }
+    result.push_back(w);
+  }
+  if(result.empty()) {
+    log_error("%s lists no witnesses\n", filename.c_str());
+  }
+  return result;
+}
+
+void usage(const std::vector<std::string>& args) {
+  printf("Usage:\n");
+  printf("%s compile [-c tables.cache] [-lut k] file.v module out.circuit\n",args[0].c_str());
+  printf("%s prover_precompute [-j threads] [-s] [-freexor] [-c tables.cache] [-lut k] file.v module rounds out.pool\n",args[0].c_str());
+  printf("%s prover_create [-j threads] [-s] [-freexor] [-chunked] [-c tables.cache] [-lut k] [-pool in.pool] file.v module inputs.dat outputs.dat security_param out.secret out.comm \n",args[0].c_str());
+  printf("%s provee_respond in.comm provee.state out.resp\n",args[0].c_str());
+  printf("%s prover_reveal [-c tables.cache] [-lut k] [file.v module inputs.dat] in.secret in.resp out.reveal\n",args[0].c_str());
+  printf("%s provee_validate [-j threads] [-c tables.cache] [-lut k] [-range first:last] [-checkpoint file] [-result file] file.v module outputs.dat security_param provee.state in.reveal\n",args[0].c_str());
+  printf("%s provee_merge [-c tables.cache] [-lut k] file.v module outputs.dat security_param provee.state in.reveal results...\n",args[0].c_str());
+  printf("%s prove [-j threads] [-freexor] [-chunked] [-c tables.cache] [-lut k] [-pool in.pool] file.v module inputs.dat outputs.dat security_param out.proof\n",args[0].c_str());
+  printf("%s prove_batch [-j threads] [-freexor] [-chunked] [-c tables.cache] [-lut k] file.v module manifest security_param\n",args[0].c_str());
+  printf("%s verify [-j threads] [-c tables.cache] [-lut k] [-range first:last] [-checkpoint file] [-result file] file.v module outputs.dat security_param in.proof\n",args[0].c_str());
+  printf("%s verify_merge [-c tables.cache] [-lut k] file.v module outputs.dat security_param in.proof results...\n",args[0].c_str());
+  printf("%s serve [-c tables.cache] [-lut k] socket [file.v module]...\n",args[0].c_str());
+  printf("%s client socket action arguments...\n",args[0].c_str());
+  printf("Any file.v module pair can be a compiled circuit and its module instead,\n");
+  printf("which -source file.v checks was compiled from file.v\n");
+}
+
+/* Runs one action, args[0] being the program name.  Yosys must be set up. */
+int run_action(const std::vector<std::string>& args, const Options& opts) {
+  if(args.size() < 5) {
+    usage(args);
     return 0;
   }
-  
-  Yosys::log_streams.push_back(&std::cout);
-  Yosys::log_error_stderr = true;
-    
-  Yosys::yosys_setup();
 
-  string action(argv[1]);
-  if(action=="prover_create") {
-    if(argc!=9) {
+  if(!opts.tablecache.empty()) {
+    TableCache_load(opts.tablecache);
+  }
+  if(!opts.seed.empty()) {
+    log_warning("-seed makes every run repeatable, the proofs are only good for benchmarking\n");
+  }
+
+  string action(args[1]);
+  if(action=="compile") {
+    if(args.size()!=5) {
       printf("Wrong number of arguments\n");
-      printf("%s prover_create file.v module inputs.dat outputs.dat security_param out.secret out.comm \n",argv[0]);
+      printf("%s compile [-c tables.cache] [-lut k] file.v module out.circuit\n",args[0].c_str());
       return 1;
     }
-    Module* module=load_module(argv[2], argv[3]);
+    if(is_compiled_circuit(args[2])) {
+      log_error("%s is already compiled\n", args[2].c_str());
+    }
+    Module* module=load_module(args[2], args[3], opts.lutsize);
     ScrambledCircuit circuit(module);
-    Const inputs=const_from_file(argv[4]);
-    Const outputs=const_from_file(argv[5]);
+
+    yosysZKP::CircuitFile file=circuit.serialize();
+    file.set_module(args[3]);
+    file.set_source_hash(source_hash(args[2], args[3]));
+    file.set_circuit_hash(circuit.circuit_fingerprint());
+
+    CodedFileWriter os(args[4], MAGIC_CIRCUIT);
+    os.WriteToStream(&file);
+    log("Compiled %d cells, circuit hash %s\n", GetSize(circuit.c.cells), hex(file.circuit_hash()).c_str());
+
+  } else if(action=="prover_create") {
+    if(args.size()!=9) {
+      printf("Wrong number of arguments\n");
+      printf("%s prover_create [-j threads] [-s] [-freexor] [-chunked] [-c tables.cache] [-lut k] [-pool in.pool] file.v module inputs.dat outputs.dat security_param out.secret out.comm \n",args[0].c_str());
+      return 1;
+    }
+    std::shared_ptr<ScrambledCircuit> loaded=load_circuit(args[2], args[3], opts);
+    ScrambledCircuit& circuit=*loaded;
+    Const inputs=const_from_file(args[4]);
+    Const outputs=const_from_file(args[5]);
 
     Const out=circuit.execute(inputs);
     if(out!=outputs) {
       log_error("Input produces output %s instead of required value\n",out.as_string().c_str());
     }
+    circuit.freexor=opts.freexor;
 
-    int security_param=atoi(argv[6]);
+    int security_param=atoi(args[6].c_str());
 
-    CodedFileWriter ss(argv[7],MAGIC_SECRET);
-    CodedFileWriter cs(argv[8],MAGIC_COMMITMENT);
+    //A pool decides the free XOR mode and the form of the secrets
+    std::unique_ptr<PoolRounds> precomputed;
+    bool seeded=opts.seeded;
+    if(!opts.pool.empty()) {
+      precomputed.reset(new PoolRounds(opts.pool, circuit, security_param));
+      circuit.freexor=precomputed->header.free_xor();
+      seeded=precomputed->header.seeded();
+    }
+
+    if(precomputed && opts.chunked) {
+      log_error("Pools hold whole rounds, -pool does not work with -chunked\n");
+    }
+
+    AsyncFileWriter ss(args[7],seeded ? MAGIC_SECRET_SEEDED : opts.chunked ? MAGIC_SECRET_V3 : MAGIC_SECRET_V2);
+    AsyncFileWriter cs(args[8],opts.chunked ? MAGIC_COMMITMENT_V3 : MAGIC_COMMITMENT_V2);
+
+    if(seeded) {
+      yosysZKP::SeededSecretHeader header;
+      header.set_fingerprint(circuit.fingerprint());
+      header.set_free_xor(circuit.freexor);
+      if(opts.chunked) {
+	header.set_chunked(true);
+      }
+      ss.WriteToStream(&header);
+    }
     
-    for(int i=0; i<security_param; i++) {
-      yosysZKP::Commitment comm=circuit.create_proof_round();
-      cs.WriteToStream(&comm);
-      
-      yosysZKP::ProverSecret sec;
-      *sec.mutable_execution()=circuit.reveal_execution();
-      *sec.mutable_scrambling()=circuit.reveal_scrambling();
+    std::unique_ptr<ThreadPool> pool=make_pool(opts.threads);
+    auto emit=[&](int, RoundOutput& out) {
+      cs.WriteRawToStream(std::move(out.comm));
+      ss.WriteRawToStream(std::move(out.sec));
+    };
+    if(opts.chunked) {
+      //One round at a time, its blocks in parallel
+      int parts=seeded ? BLOCK_COMMIT : BLOCK_COMMIT|BLOCK_EXECUTION|BLOCK_SCRAMBLING;
+      for(int i=0; i<security_param; i++) {
+	std::string seed=new_round_seed(i, opts.seed);
+	if(seeded) {
+	  yosysZKP::ProverSecret sec;
+	  sec.set_seed(seed);
+	  ss.WriteToStream(&sec);
+	}
+	chunked_round(circuit, seed, parts, pool.get(), [&](RoundOutput& out) {
+	    cs.WriteRawToStream(std::move(out.comm));
+	    if(!seeded) {
+	      ss.WriteRawToStream(std::move(out.sec));
+	    }
+	  });
+      }
+    } else if(precomputed) {
+      finish_pool_rounds(circuit, *precomputed, pool.get(), emit);
+    } else {
+      create_rounds(circuit, security_param, pool.get(), opts.seeded, opts.seed, emit);
+    }
 
-      ss.WriteToStream(&sec);
+  } else if(action=="prover_precompute") {
+    if(args.size()!=6) {
+      printf("Wrong number of arguments\n");
+      printf("%s prover_precompute [-j threads] [-s] [-freexor] [-c tables.cache] [-lut k] file.v module rounds out.pool\n",args[0].c_str());
+      return 1;
     }
+    std::shared_ptr<ScrambledCircuit> loaded=load_circuit(args[2], args[3], opts);
+    ScrambledCircuit& circuit=*loaded;
+    circuit.freexor=opts.freexor;
+    int rounds=atoi(args[4].c_str());
+
+    AsyncFileWriter ps(args[5],MAGIC_POOL);
+    yosysZKP::PoolHeader header;
+    header.set_circuit(circuit.circuit_fingerprint());
+    header.set_rounds(rounds);
+    header.set_free_xor(circuit.freexor);
+    header.set_seeded(opts.seeded);
+    ps.WriteToStream(&header);
+
+    std::unique_ptr<ThreadPool> pool=make_pool(opts.threads);
+    precompute_rounds(circuit, rounds, pool.get(), opts.seeded, opts.seed, [&](int, std::string& round) {
+	ps.WriteRawToStream(std::move(round));
+      });
 
   } else if(action=="provee_respond") {
-    if(argc!=5) {
+    if(args.size()!=5) {
       printf("Wrong number of arguments\n");
-      printf("%s provee_respond in.comm provee.state out.resp\n",argv[0]);
+      printf("%s provee_respond in.comm provee.state out.resp\n",args[0].c_str());
       return 1;
     }
 
-    CryptoPP::AutoSeededRandomPool rand;
+    CryptoPP::AutoSeededRandomPool osrand;
+    KeystreamRNG fixedrand;
+    if(!opts.seed.empty()) {
+      fixedrand.SeedFrom("respond:"+opts.seed, 0);
+    }
+    CryptoPP::RandomNumberGenerator& rand=opts.seed.empty() ? (CryptoPP::RandomNumberGenerator&)osrand : fixedrand;
 
-    CodedFileReader is(argv[2],MAGIC_COMMITMENT);
-    CodedFileWriter os(argv[3],MAGIC_PROVEE);
+    //Answer in the format the commitment came in
+    CodedFileReader is(args[2],MAGIC_COMMITMENT,MAGIC_COMMITMENT_V2,MAGIC_COMMITMENT_V3);
+    bool packed=is.version!=FORMAT_UNPACKED;
+    bool chunked=is.version==FORMAT_CHUNKED;
+    CodedFileWriter os(args[3],chunked ? MAGIC_PROVEE_V3 : packed ? MAGIC_PROVEE_V2 : MAGIC_PROVEE,!chunked);
 
     yosysZKP::RevealRequest request;
     yosysZKP::ProveeState roundstate;
@@ -116,22 +1421,82 @@ int main(int argc, char** argv)
       os.WriteToStream(&roundstate);
       
       request.add_scrambling(scrambled);
+
+      //The blocks of a chunked round are copied as they are, each with the challenge
+      int blocks=chunked ? roundstate.commitment().blocks() : 0;
+      for(int k=0; k<blocks; k++) {
+	yosysZKP::ProveeState block;
+	const char* data;
+	size_t size;
+	if(!is.ReadRawFromStream(&data, &size) || size>INT_MAX || !block.mutable_commitment()->ParsePartialFromArray(data, size)) {
+	  log_error("Commitment is missing blocks\n");
+	}
+	block.set_scrambling(scrambled);
+	std::string out;
+	serialize_block_into(block, out);
+	os.WriteRawToStream(out);
+      }
     }
 
-    CodedFileWriter ros(argv[4],MAGIC_REQUEST);
+    CodedFileWriter ros(args[4],packed ? MAGIC_REQUEST_V2 : MAGIC_REQUEST);
 
     ros.WriteToStream(&request);
 
+  } else if(action=="prover_reveal" && args.size()==8) {
+    //Seeded secret: rebuild each round from its seed and reveal the requested half
+    std::shared_ptr<ScrambledCircuit> loaded=load_circuit(args[2], args[3], opts);
+    ScrambledCircuit& circuit=*loaded;
+    circuit.execute(const_from_file(args[4]));
+
+    CodedFileReader sis(args[5],MAGIC_SECRET_SEEDED);
+    CodedFileReader ris(args[6],MAGIC_REQUEST,MAGIC_REQUEST_V2);
+
+    yosysZKP::SeededSecretHeader header;
+    if(!sis.ReadFromStream(&header) || header.fingerprint()!=circuit.fingerprint()) {
+      log_error("Secret was not created for this circuit and input\n");
+    }
+    circuit.freexor=header.free_xor();
+
+    AsyncFileWriter os(args[7],header.chunked() ? MAGIC_REVEAL_V3 : MAGIC_REVEAL_V2,!header.chunked());
+
+    yosysZKP::RevealRequest request;
+    ris.ReadFromStream(&request);
+
+    std::vector<std::string> seeds;
+    std::vector<bool> scrambling(request.scrambling().begin(), request.scrambling().end());
+    yosysZKP::ProverSecret secret;
+    for(size_t i=0; i<scrambling.size(); i++) {
+      if(!sis.ReadFromStream(&secret) || secret.seed().size()!=KeystreamRNG::SEED_SIZE) {
+	log_error("Secret does not hold a seed for every requested round\n");
+      }
+      seeds.push_back(secret.seed());
+    }
+
+    std::unique_ptr<ThreadPool> pool=make_pool(opts.threads);
+    if(header.chunked()) {
+      for(size_t i=0; i<scrambling.size(); i++) {
+	chunked_round(circuit, seeds[i], scrambling[i] ? BLOCK_SCRAMBLING : BLOCK_EXECUTION, pool.get(), [&](RoundOutput& out) {
+	    os.WriteRawToStream(std::move(out.sec));
+	  });
+      }
+    } else {
+      reveal_seeded_rounds(circuit, seeds, scrambling, pool.get(), [&](int, std::string& reveal) {
+	  os.WriteRawToStream(std::move(reveal));
+	});
+    }
+
+    std::remove(args[5].c_str());
   } else if(action=="prover_reveal") {
-    if(argc!=5) {
+    if(args.size()!=5) {
       printf("Wrong number of arguments\n");
-      printf("%s prover_reveal in.secret in.resp out.reveal\n",argv[0]);
+      printf("%s prover_reveal [-c tables.cache] [-lut k] [file.v module inputs.dat] in.secret in.resp out.reveal\n",args[0].c_str());
       return 1;
     }
-    CodedFileReader sis(argv[2],MAGIC_SECRET);
-    CodedFileReader ris(argv[3],MAGIC_REQUEST);
+    CodedFileReader sis(args[2],MAGIC_SECRET,MAGIC_SECRET_V2,MAGIC_SECRET_V3);
+    CodedFileReader ris(args[3],MAGIC_REQUEST,MAGIC_REQUEST_V2);
 
-    CodedFileWriter os(argv[4],MAGIC_REVEAL);
+    bool chunked=sis.version==FORMAT_CHUNKED;
+    CodedFileWriter os(args[4],chunked ? MAGIC_REVEAL_V3 : sis.version==FORMAT_PACKED ? MAGIC_REVEAL_V2 : MAGIC_REVEAL,!chunked);
 
     yosysZKP::RevealRequest request;
     ris.ReadFromStream(&request);
@@ -146,66 +1511,372 @@ int main(int argc, char** argv)
 	secret.clear_scrambling();
       }
 	os.WriteToStream(&secret);
+
+      //Chunked rounds: the same for each block, one block in memory at a time
+      int blocks=chunked ? secret.blocks() : 0;
+      for(int k=0; k<blocks; k++) {
+	yosysZKP::ProverSecret block;
+	const char* data;
+	size_t size;
+	if(!sis.ReadRawFromStream(&data, &size) || size>INT_MAX || !block.ParsePartialFromArray(data, size)) {
+	  log_error("Secret is missing blocks\n");
+	}
+	if(b) {
+	  block.clear_execution();
+	} else {
+	  block.clear_scrambling();
+	}
+	std::string out;
+	serialize_block_into(block, out);
+	os.WriteRawToStream(out);
+      }
     }
     
     //Remove the secret because otherwise ppl will do dumb stuff with it like reveal it twice...
-    std::remove(argv[2]);
+    std::remove(args[2].c_str());
   } else if(action=="provee_validate") {
-    if(argc!=8) {
+    if(args.size()!=8) {
       printf("Wrong number of arguments\n");
-       printf("%s provee_validate file.v module outputs.dat security_param provee.state in.reveal\n",argv[0]);
+      printf("%s provee_validate [-j threads] [-c tables.cache] [-lut k] [-range first:last] [-checkpoint file] [-result file] file.v module outputs.dat security_param provee.state in.reveal\n",args[0].c_str());
       return 1;
     }
-    Module* module=load_module(argv[2], argv[3]);
-    ScrambledCircuit circuit(module);
+    std::shared_ptr<ScrambledCircuit> loaded=load_circuit(args[2], args[3], opts);
+    ScrambledCircuit& circuit=*loaded;
 
-    Const outputs=const_from_file(argv[4]);
-    int security_param=atoi(argv[5]);
+    Const outputs=const_from_file(args[4]);
+    int security_param=atoi(args[5].c_str());
 
-    CodedFileReader ss(argv[6],MAGIC_PROVEE);
-    CodedFileReader rs(argv[7],MAGIC_REVEAL);
+    CodedFileReader ss(args[6],MAGIC_PROVEE,MAGIC_PROVEE_V2,MAGIC_PROVEE_V3);
+    CodedFileReader rs(args[7],MAGIC_REVEAL,MAGIC_REVEAL_V2,MAGIC_REVEAL_V3);
+    bool chunked=ss.version==FORMAT_CHUNKED;
+    if(chunked!=(rs.version==FORMAT_CHUNKED)) {
+      log_error("Only one of the commitment and the reveal is chunked\n");
+    }
 
     int count=0;
+    bool partial=false;
 
     yosysZKP::ProveeState state;
     yosysZKP::ProverSecret secret;
 
-    while(ss.ReadFromStream(&state)) {
-      if(state.commitment().output_size()!=outputs.size()) {
-	log_error("Outputs do not match requirements\n");
-      }
-      for(int i=0; i<outputs.size(); i++) {
-	if((outputs[i]==State::S1)!=state.commitment().output(i)) {
+    if(opts.ranged() && chunked) {
+      log_error("Rounds can only be validated in ranges when they are not chunked\n");
+    } else if(opts.ranged()) {
+      IndexedRounds rounds(ss, 0, rs, 0, ss.indexed_messages(), nullptr);
+      count=validate_range(circuit, outputs, security_param, opts, rounds);
+      partial=count!=rounds.rounds;
+    } else if(chunked) {
+      std::unique_ptr<ThreadPool> pool=make_pool(opts.threads);
+      count=validate_chunked_rounds(circuit, outputs, pool.get(), ss, rs, nullptr);
+    } else if(opts.threads>1) {
+      count=validate_rounds_parallel(circuit, outputs, opts.threads,
+				     [&](RawRound& r) { return ss.ReadRawFromStream(&r.state, &r.statesize); },
+				     [&](RawRound& r) { return rs.ReadRawFromStream(&r.reveal, &r.revealsize); });
+    } else {
+      while(ss.ReadFromStream(&state)) {
+	if(!outputs_match(state.commitment(), outputs)) {
 	  log_error("Outputs do not match requirements\n");
 	}
+
+	if(!rs.ReadFromStream(&secret)) {
+	  log_error("Mismatch between commitment and reveal!\n");
+	}
+
+	bool validated;
+	if(state.scrambling()) {
+	  validated=circuit.validate_precommitment(state.commitment(), secret.scrambling());
+	} else {
+	  validated=circuit.validate_precommitment(state.commitment(), secret.execution());
+	}
+	if(!validated) {
+	  log_error("Proof round did not validate\n");
+	}
+	count++;
       }
+    }
 
-      if(!rs.ReadFromStream(&secret)) {
-	log_error("Mismatch between commitment and reveal!\n");
+    if(partial) {
+      log("Only part of the proof was validated, combine the results with provee_merge\n");
+    } else if(count>=security_param) {
+      log("SUCCESS: Proven with confidence 2^-%d\n",count);
+    } else {
+      log_error("Not enough proof rounds to satisfy security requirement\n");
+    }
+
+  } else if(action=="prove") {
+    if(args.size()!=8) {
+      printf("Wrong number of arguments\n");
+      printf("%s prove [-j threads] [-freexor] [-chunked] [-c tables.cache] [-lut k] [-pool in.pool] file.v module inputs.dat outputs.dat security_param out.proof\n",args[0].c_str());
+      return 1;
+    }
+    std::shared_ptr<ScrambledCircuit> loaded=load_circuit(args[2], args[3], opts);
+    ScrambledCircuit& circuit=*loaded;
+    Const inputs=const_from_file(args[4]);
+    Const outputs=const_from_file(args[5]);
+
+    Const out=circuit.execute(inputs);
+    if(out!=outputs) {
+      log_error("Input produces output %s instead of required value\n",out.as_string().c_str());
+    }
+
+    circuit.freexor=opts.freexor;
+
+    int security_param=atoi(args[6].c_str());
+
+    std::unique_ptr<PoolRounds> precomputed;
+    if(!opts.pool.empty()) {
+      if(opts.chunked) {
+	log_error("Pools hold whole rounds, -pool does not work with -chunked\n");
       }
+      precomputed.reset(new PoolRounds(opts.pool, circuit, security_param));
+      circuit.freexor=precomputed->header.free_xor();
+    }
 
-      bool validated;
-      if(state.scrambling()) {
-	validated=circuit.validate_precommitment(state.commitment(), secret.scrambling());
-      } else {
-	validated=circuit.validate_precommitment(state.commitment(), secret.execution());
+    std::unique_ptr<ThreadPool> pool=make_pool(opts.threads);
+    prove_execution(circuit, outputs, security_param, pool.get(), opts.seed, args[7], opts.chunked, precomputed.get());
+
+  } else if(action=="prove_batch") {
+    if(args.size()!=6) {
+      printf("Wrong number of arguments\n");
+      printf("%s prove_batch [-j threads] [-freexor] [-chunked] [-c tables.cache] [-lut k] file.v module manifest security_param\n",args[0].c_str());
+      return 1;
+    }
+    auto start=std::chrono::steady_clock::now();
+    std::shared_ptr<ScrambledCircuit> loaded=load_circuit(args[2], args[3], opts);
+    ScrambledCircuit& circuit=*loaded;
+    circuit.freexor=opts.freexor;
+    int security_param=atoi(args[5].c_str());
+
+    if(!opts.pool.empty()) {
+      log_error("A pool only holds the rounds of one proof, -pool does not work with prove_batch\n");
+    }
+    std::vector<BatchWitness> witnesses=read_manifest(args[4]);
+    std::vector<Const> inputs, outputs;
+    for(const BatchWitness& w:witnesses) {
+      inputs.push_back(const_from_file(w.inputs));
+      outputs.push_back(const_from_file(w.outputs));
+    }
+    auto loadtime=std::chrono::steady_clock::now();
+
+    std::vector<WireValues> executions;
+    std::vector<Const> out=circuit.execute_batch(inputs, executions);
+    for(size_t w=0; w<witnesses.size(); w++) {
+      if(out[w]!=outputs[w]) {
+	log_error("%s produces output %s instead of required value\n", witnesses[w].inputs.c_str(), out[w].as_string().c_str());
       }
-      if(!validated) {
-	log_error("Proof round did not validate\n");
+    }
+    auto exectime=std::chrono::steady_clock::now();
+
+    std::unique_ptr<ThreadPool> pool=make_pool(opts.threads);
+    for(size_t w=0; w<witnesses.size(); w++) {
+      circuit.execution=std::move(executions[w]);
+      std::string fixedseed=opts.seed.empty() ? "" : opts.seed+":"+std::to_string(w);
+      prove_execution(circuit, outputs[w], security_param, pool.get(), fixedseed, witnesses[w].proof, opts.chunked);
+      log("Wrote %s\n", witnesses[w].proof.c_str());
+    }
+    auto end=std::chrono::steady_clock::now();
+
+    double n=witnesses.size();
+    double loading=std::chrono::duration<double>(loadtime-start).count();
+    double executing=std::chrono::duration<double>(exectime-loadtime).count();
+    double proving=std::chrono::duration<double>(end-exectime).count();
+    log("Proved %d witnesses in %.3f s: loading %.3f s, executing %.3f s, proving %.3f s\n",
+	(int)witnesses.size(), loading+executing+proving, loading, executing, proving);
+    log("Per witness: %.3f s, of which %.3f s loading, %.3f s executing and %.3f s proving\n",
+	(loading+executing+proving)/n, loading/n, executing/n, proving/n);
+
+  } else if(action=="verify") {
+    if(args.size()!=7) {
+      printf("Wrong number of arguments\n");
+      printf("%s verify [-j threads] [-c tables.cache] [-lut k] [-range first:last] [-checkpoint file] [-result file] file.v module outputs.dat security_param in.proof\n",args[0].c_str());
+      return 1;
+    }
+    std::shared_ptr<ScrambledCircuit> loaded=load_circuit(args[2], args[3], opts);
+    ScrambledCircuit& circuit=*loaded;
+
+    Const outputs=const_from_file(args[4]);
+    int security_param=atoi(args[5].c_str());
+
+    //One reader walks the commitments and another the reveals behind them.
+    //The reveal reader hashes the commitments on its way past them, so the
+    //challenges are known before the first round is checked.
+    CodedFileReader cs(args[6],MAGIC_PROOF);
+    CodedFileReader rs(args[6],MAGIC_PROOF);
+    yosysZKP::ProofHeader header;
+    if(!cs.ReadFromStream(&header) || !rs.ReadFromStream(&header) || header.rounds()<0) {
+      log_error("Could not read proof header\n");
+    }
+    int rounds=header.rounds();
+
+    bool chunked=header.chunked();
+
+    ChallengeHasher hasher(circuit.circuit_fingerprint(), outputs, rounds);
+    for(int i=0; i<rounds; i++) {
+      const char* raw;
+      size_t size;
+      if(!rs.ReadRawFromStream(&raw, &size)) {
+	log_error("Proof is missing commitments\n");
+      }
+      hasher.add_commitment(raw, size);
+
+      //The header of a chunked round says how many blocks follow it
+      yosysZKP::Commitment comm;
+      if(chunked && (size>INT_MAX || !comm.ParseFromArray(raw, size))) {
+	log_error("Could not read commitment header\n");
+      }
+      for(int k=0; k<comm.blocks(); k++) {
+	if(!rs.ReadRawFromStream(&raw, &size)) {
+	  log_error("Proof is missing commitments\n");
+	}
+	hasher.add_commitment(raw, size);
+      }
+    }
+    std::vector<bool> challenges=hasher.challenges();
+
+    int count;
+    bool partial=false;
+    if(opts.ranged() && chunked) {
+      log_error("Rounds can only be verified in ranges when they are not chunked\n");
+    } else if(chunked) {
+      std::unique_ptr<ThreadPool> pool=make_pool(opts.threads);
+      count=validate_chunked_rounds(circuit, outputs, pool.get(), cs, rs, &challenges);
+    } else if(opts.ranged()) {
+      //Commitments follow the header, the reveals follow the commitments
+      IndexedRounds indexed(cs, 1, rs, 1+rounds, rounds, &challenges);
+      count=validate_range(circuit, outputs, security_param, opts, indexed);
+      partial=count!=rounds;
+    } else {
+      int next=0;
+      count=validate_rounds_parallel(circuit, outputs, opts.threads,
+				     [&](RawRound& r) {
+				       if(next==rounds || !cs.ReadRawFromStream(&r.state, &r.statesize)) {
+					 return false;
+				       }
+				       r.bare=true;
+				       r.scrambling=challenges[next++];
+				       return true;
+				     },
+				     [&](RawRound& r) { return rs.ReadRawFromStream(&r.reveal, &r.revealsize); });
+      if(count!=rounds) {
+	log_error("Mismatch between commitment and reveal!\n");
       }
-      count++;
     }
 
-    if(count>=security_param) {
+    if(partial) {
+      log("Only part of the proof was verified, combine the results with verify_merge\n");
+    } else if(count>=security_param) {
       log("SUCCESS: Proven with confidence 2^-%d\n",count);
     } else {
       log_error("Not enough proof rounds to satisfy security requirement\n");
     }
 
+  } else if(action=="provee_merge") {
+    if(args.size()<9) {
+      printf("Wrong number of arguments\n");
+      printf("%s provee_merge [-c tables.cache] [-lut k] file.v module outputs.dat security_param provee.state in.reveal results...\n",args[0].c_str());
+      return 1;
+    }
+    std::shared_ptr<ScrambledCircuit> loaded=load_circuit(args[2], args[3], opts);
+    yosysZKP::ValidationResult statement=result_statement(*loaded, const_from_file(args[4]), atoi(args[5].c_str()));
+
+    CodedFileReader ss(args[6],MAGIC_PROVEE,MAGIC_PROVEE_V2);
+    CodedFileReader rs(args[7],MAGIC_REVEAL,MAGIC_REVEAL_V2);
+    IndexedRounds rounds(ss, 0, rs, 0, ss.indexed_messages(), nullptr);
+    merge_results(rounds, statement, std::vector<std::string>(args.begin()+8, args.end()));
+
+  } else if(action=="verify_merge") {
+    if(args.size()<8) {
+      printf("Wrong number of arguments\n");
+      printf("%s verify_merge [-c tables.cache] [-lut k] file.v module outputs.dat security_param in.proof results...\n",args[0].c_str());
+      return 1;
+    }
+    std::shared_ptr<ScrambledCircuit> loaded=load_circuit(args[2], args[3], opts);
+    yosysZKP::ValidationResult statement=result_statement(*loaded, const_from_file(args[4]), atoi(args[5].c_str()));
+
+    CodedFileReader cs(args[6],MAGIC_PROOF);
+    CodedFileReader rs(args[6],MAGIC_PROOF);
+    yosysZKP::ProofHeader header;
+    if(!cs.ReadFromStream(&header) || header.rounds()<0) {
+      log_error("Could not read proof header\n");
+    }
+    if(header.chunked()) {
+      log_error("Chunked proofs are never verified in ranges, there is nothing to merge\n");
+    }
+    if(header.rounds()<statement.security_param()) {
+      log_error("Proof has fewer rounds than the security parameter\n");
+    }
+    IndexedRounds rounds(cs, 1, rs, 1+header.rounds(), header.rounds(), nullptr);
+    merge_results(rounds, statement, std::vector<std::string>(args.begin()+7, args.end()));
+
   } else {
     log_error("Unkown action %s\n",action.c_str());
   }
 
-Yosys::yosys_shutdown();
+  if(!opts.tablecache.empty()) {
+    TableCache_save(opts.tablecache);
+  }
+
+  if(opts.stats=="-") {
+    fputs(stats_json(action).c_str(), stderr);
+  } else if(!opts.stats.empty()) {
+    std::ofstream(opts.stats) << stats_json(action);
+  }
+
   return 0;
 }
+
+/* A request to a daemon, with the command line of a client minus the program name */
+int run_request(const std::vector<std::string>& request, std::function<void(const std::string&)> started) {
+  std::vector<std::string> argv(1, "yosysZKP");
+  argv.insert(argv.end(), request.begin(), request.end());
+  Options opts;
+  std::vector<std::string> args=parse_options(argv, opts);
+  started(args.size()>1 ? args[1] : "");
+  if(!opts.stats.empty()) {
+    stats_start();
+  }
+  return run_action(args, opts);
+}
+
+int main(int argc, char** argv)
+{
+  std::vector<std::string> cmdline(argv, argv+argc);
+  if(cmdline.size()>=4 && cmdline[1]=="client") {
+    return Daemon_request(cmdline[2], std::vector<std::string>(cmdline.begin()+3, cmdline.end()));
+  }
+
+  Options opts;
+  std::vector<std::string> args=parse_options(cmdline, opts);
+  if(!opts.stats.empty()) {
+    stats_start();
+  }
+  bool serve=args.size()>=3 && args[1]=="serve";
+  if(args.size() < 5 && !serve) {
+    usage(args);
+    return 0;
+  }
+  
+  Yosys::log_streams.push_back(&std::cout);
+  Yosys::log_error_stderr = true;
+    
+  Yosys::yosys_setup();
+
+  if(serve) {
+    if(args.size()%2!=1) {
+      printf("Wrong number of arguments\n");
+      printf("%s serve [-c tables.cache] [-lut k] socket [file.v module]...\n",args[0].c_str());
+      return 1;
+    }
+    if(!opts.tablecache.empty()) {
+      TableCache_load(opts.tablecache);
+    }
+    for(size_t i=3; i<args.size(); i+=2) {
+      resident[resident_key(args[i], args[i+1], opts.lutsize)]=load_circuit(args[i], args[i+1], opts);
+    }
+    Daemon_serve(args[2], run_request);
+  }
+
+  int status=run_action(args, opts);
+  Yosys::yosys_shutdown();
+  return status;
+}